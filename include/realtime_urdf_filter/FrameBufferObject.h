@@ -42,6 +42,13 @@
 *								n=8, 16 or 32; 16 and 32 are half-float / float buffers,
 *								t for RenderTexture support
 *
+*	cN=format		- color attachment N with its own format, for render targets
+*								that do not all look the same. format is one of r8, r16f,
+*								r32f, r8ui, r16ui, r32ui, rg16f, rg32f, rgba8, rgba16f,
+*								rgba32f. these are always textures with nearest filtering,
+*								and replace a rgba / rgb attribute. attachments have to be
+*								numbered from c0 without gaps, e.g. "c0=r32f c1=r8 c2=r16ui"
+*
 * The following other attributes are supported.
 *
 * depth=n[t]	- must have n-bit depth buffer, omit n for default (24 bits),
@@ -148,6 +155,13 @@ public:
 	/// get the Texture ID of the depth attachment
 	GLuint						getDepthAttachmentID(void);
 
+	/// get the ID of the framebuffer itself, e.g. to blit from or into it
+	GLuint						getFramebufferID(void);
+
+	/// attach or detach the depth texture while the FBO is bound, e.g. to
+	/// sample it in a later pass
+	void						setDepthAttachmentEnabled(bool enabled);
+
 	/// get the Texture ID of the stencil attachment
 	GLuint						getStencilAttachmentID(void);
 
@@ -277,6 +291,13 @@ protected:
 	/// indicates if color buffer is a float texture
 	bool										_bFloatColorBuffer;
 
+	/// color attachments have individual formats (cN=format)
+	bool										_bPerAttachmentFormats;
+	/// internal format, format and type of every color attachment, 0 if unset
+	GLint										_attachmentInternalFormat[MAX_COLOR_COMPONENTS];
+	GLenum										_attachmentFormat[MAX_COLOR_COMPONENTS];
+	GLenum										_attachmentType[MAX_COLOR_COMPONENTS];
+
 private:
 
 	/// parse the mode string and set configuration
@@ -286,6 +307,12 @@ private:
 	/// get the key=value pair of a single token from the mode string
 	KeyVal										getKeyValuePair(std::string token);
 
+	/// set the format of color attachment index from a cN=format value
+	bool										setAttachmentFormat(int index, const std::string &format);
+
+	/// create the color attachment textures with individual formats
+	bool										initializePerAttachmentFormats(void);
+
 
 };
 
@@ -0,0 +1,148 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REALTIME_URDF_FILTER_ASSET_CACHE_H_
+#define REALTIME_URDF_FILTER_ASSET_CACHE_H_
+
+#include <urdf/model.h>
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <realtime_urdf_filter/renderable.h>
+#include <stdint.h>
+#include <map>
+#include <set>
+
+namespace realtime_urdf_filter
+{
+
+// one link of a model from a scene bundle (see scene_bundle.h), with the
+// joint to its parent
+struct CompiledLink
+{
+  std::string name;
+  int parent;
+  std::string joint_name;
+  int joint_type;
+  tf::Transform joint_origin;
+  tf::Vector3 joint_axis;
+
+  // visual, geometry is NULL if the link has none
+  boost::shared_ptr<Geometry> geometry;
+  tf::Transform visual_origin;
+  tf::Vector3 scale;
+  urdf::Color color;
+};
+
+// everything URDFRenderer needs from a URDF, without parsing it
+struct CompiledModel
+{
+  std::string name;
+  std::vector<CompiledLink> links;
+};
+
+// process wide cache of parsed URDF models (by content) and of geometry (by
+// mesh URI or primitive shape), shared by all URDFRenderers. the same
+// robot_description loaded with several tf_prefixes is parsed once, every
+// mesh is imported once, and InstancedScene uploads every Geometry once.
+// assets stay cached until prune () is called while nobody uses them, so
+// reloading the models (e.g. after the image size changed) is cheap.
+// a scene bundle preloads compiled models and their geometry, these are
+// never pruned. all methods are thread safe.
+class AssetCache
+{
+  public:
+    static AssetCache& instance ();
+
+    // returns the parsed model for this description, or NULL if it does not
+    // parse
+    boost::shared_ptr<const urdf::Model> getModel (const std::string &description);
+
+    // returns the compiled model for this description from a loaded bundle,
+    // or NULL if no bundle contains it
+    boost::shared_ptr<const CompiledModel> getCompiledModel (const std::string &description);
+
+    // adds all models and geometry of a scene bundle written by
+    // urdf_filter_bundle, returns false if the file is not a valid bundle
+    bool loadBundle (const std::string &file_name);
+
+    // returns the geometry registered under key. the first caller creates it
+    // with init (outside of the cache lock, so different keys are created in
+    // parallel), concurrent callers for the same key wait until it is done.
+    // if init returns false, the callers get the empty geometry, but it is
+    // not kept, so the next call tries again
+    boost::shared_ptr<Geometry> getGeometry (const std::string &key,
+                                             const boost::function<bool (Geometry&)> &init);
+
+    // true if key is cached (or being created)
+    bool hasGeometry (const std::string &key);
+
+    // returns the geometry registered under key if it is completely created,
+    // NULL otherwise. never waits and never creates anything
+    boost::shared_ptr<Geometry> findGeometry (const std::string &key);
+
+    // copies the key and geometry of everything that is cached
+    void getGeometries (std::map<std::string, boost::shared_ptr<Geometry> > &geometries);
+
+    // drops all assets that are only referenced by the cache
+    void prune ();
+
+    // statistics
+    unsigned int numModels ();
+    unsigned int numGeometries ();
+    unsigned int numCompiledModels ();
+    unsigned int numHits ();
+    unsigned int numMisses ();
+
+  private:
+    AssetCache () : hits_ (0), misses_ (0) {}
+
+    struct ModelEntry
+    {
+      std::string description;
+      boost::shared_ptr<const urdf::Model> model;
+    };
+
+    boost::mutex mutex_;
+    // geometry that is still being created, and the signal when one is done
+    std::set<const Geometry*> pending_;
+    boost::condition_variable created_cond_;
+    // keyed by the hash of the description, collisions are not cached
+    std::map<size_t, ModelEntry> models_;
+    std::map<std::string, boost::shared_ptr<Geometry> > geometries_;
+    // keyed by hashDescription (), along with the size of the description
+    std::map<uint64_t, std::pair<size_t, boost::shared_ptr<const CompiledModel> > > compiled_models_;
+    unsigned int hits_;
+    unsigned int misses_;
+};
+
+} // end namespace
+
+#endif
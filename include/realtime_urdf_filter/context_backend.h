@@ -0,0 +1,68 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REALTIME_URDF_FILTER_CONTEXT_BACKEND_H_
+#define REALTIME_URDF_FILTER_CONTEXT_BACKEND_H_
+
+#include <string>
+
+namespace realtime_urdf_filter
+{
+
+// an OpenGL context the filter can render in. the "glut" backend opens a
+// (possibly hidden) window and needs an X server, "egl" and "osmesa" are
+// purely offscreen and work on headless machines.
+class ContextBackend
+{
+  public:
+    virtual ~ContextBackend () {}
+
+    // named constructor, returns NULL if the backend is unknown, was not
+    // compiled in or could not create a context
+    static ContextBackend* create (const std::string &backend,
+                                   int width, int height, bool show_window,
+                                   int &argc, char **argv);
+
+    // make the context current for the calling thread
+    virtual bool makeCurrent () = 0;
+
+    // present the window contents and process window events
+    virtual void swapBuffers () {}
+
+    // does this backend have a visible window to draw the gui into?
+    virtual bool hasWindow () const {return false;}
+
+    // name of the backend, for logging
+    virtual std::string name () const = 0;
+};
+
+} // end namespace
+
+#endif
@@ -0,0 +1,132 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REALTIME_URDF_FILTER_DEPTH_FRAME_FILE_H_
+#define REALTIME_URDF_FILTER_DEPTH_FRAME_FILE_H_
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+namespace realtime_urdf_filter
+{
+
+// simple file format for recorded depth frames:
+//   DepthFrameFileHeader, followed by num_frames images of
+//   width * height 32 bit floats (depth in meters, row major)
+struct DepthFrameFileHeader
+{
+  char magic[8];          // "RUFDEPTH"
+  uint32_t version;       // 1
+  uint32_t width;
+  uint32_t height;
+  uint32_t num_frames;
+  double fx, fy, cx, cy;  // pinhole intrinsics of the recording camera
+};
+
+// read-only, memory mapped view of a depth frame file
+class DepthFrameFile
+{
+  public:
+    DepthFrameFile ()
+      : data_ (NULL), size_ (0), header_ (NULL)
+    {}
+
+    ~DepthFrameFile ()
+    {
+      close ();
+    }
+
+    // maps the file into memory, returns false if it is not a valid frame file
+    bool open (const std::string &file_name)
+    {
+      close ();
+      int fd = ::open (file_name.c_str (), O_RDONLY);
+      if (fd < 0)
+        return false;
+
+      struct stat st;
+      if (fstat (fd, &st) != 0 || st.st_size < (off_t) sizeof(DepthFrameFileHeader))
+      {
+        ::close (fd);
+        return false;
+      }
+
+      void* data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close (fd);
+      if (data == MAP_FAILED)
+        return false;
+
+      data_ = (const unsigned char*) data;
+      size_ = st.st_size;
+      header_ = (const DepthFrameFileHeader*) data_;
+
+      size_t expected = sizeof(DepthFrameFileHeader) + (size_t) header_->num_frames * frameSize ();
+      if (memcmp (header_->magic, "RUFDEPTH", 8) != 0 || header_->version != 1 || size_ < expected)
+      {
+        close ();
+        return false;
+      }
+      return true;
+    }
+
+    void close ()
+    {
+      if (data_)
+        munmap ((void*) data_, size_);
+      data_ = NULL;
+      size_ = 0;
+      header_ = NULL;
+    }
+
+    const DepthFrameFileHeader& header () const {return *header_;}
+    unsigned int numFrames () const {return header_->num_frames;}
+    size_t frameSize () const {return (size_t) header_->width * header_->height * sizeof(float);}
+
+    // pointer to the i-th frame, directly in the mapped file
+    const float* frame (unsigned int i) const
+    {
+      return (const float*) (data_ + sizeof(DepthFrameFileHeader) + i * frameSize ());
+    }
+
+  private:
+    const unsigned char* data_;
+    size_t size_;
+    const DepthFrameFileHeader* header_;
+};
+
+} // end namespace
+
+#endif
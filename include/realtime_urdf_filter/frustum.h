@@ -0,0 +1,97 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REALTIME_URDF_FILTER_FRUSTUM_H_
+#define REALTIME_URDF_FILTER_FRUSTUM_H_
+
+#include <tf/tf.h>
+#include <cmath>
+
+namespace realtime_urdf_filter
+{
+
+// view frustum as six planes, extracted from a (column major) projection *
+// view matrix. plane normals point inside, so points inside the frustum
+// have a positive distance to all planes.
+struct Frustum
+{
+  Frustum ()
+  {
+    // everything is inside until set
+    for (int p = 0; p < 6; ++p)
+      for (int i = 0; i < 4; ++i)
+        planes[p][i] = (i == 3) ? 1.0 : 0.0;
+  }
+
+  Frustum (const double* projection, const double* view)
+  {
+    double m[16];
+    for (int c = 0; c < 4; ++c)
+      for (int r = 0; r < 4; ++r)
+      {
+        m[c*4 + r] = 0.0;
+        for (int k = 0; k < 4; ++k)
+          m[c*4 + r] += projection[k*4 + r] * view[c*4 + k];
+      }
+
+    // left, right, bottom, top, near, far: row 3 +- row 0, 1, 2
+    for (int p = 0; p < 6; ++p)
+    {
+      double sign = (p % 2 == 0) ? 1.0 : -1.0;
+      int row = p / 2;
+      double length = 0.0;
+      for (int i = 0; i < 4; ++i)
+      {
+        planes[p][i] = m[i*4 + 3] + sign * m[i*4 + row];
+        if (i < 3)
+          length += planes[p][i] * planes[p][i];
+      }
+      length = std::sqrt (length);
+      for (int i = 0; i < 4; ++i)
+        planes[p][i] /= length;
+    }
+  }
+
+  // true if the sphere is at least partially inside
+  bool intersectsSphere (const tf::Vector3 &center, double radius) const
+  {
+    for (int p = 0; p < 6; ++p)
+      if (planes[p][0] * center.x () + planes[p][1] * center.y () +
+          planes[p][2] * center.z () + planes[p][3] < -radius)
+        return false;
+    return true;
+  }
+
+  double planes[6][4];
+};
+
+} // end namespace
+
+#endif
@@ -0,0 +1,141 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REALTIME_URDF_FILTER_INSTANCED_SCENE_H_
+#define REALTIME_URDF_FILTER_INSTANCED_SCENE_H_
+
+#include <realtime_urdf_filter/frustum.h>
+#include <realtime_urdf_filter/urdf_renderer.h>
+
+namespace realtime_urdf_filter
+{
+
+// draws the renderables of all URDF models grouped by their shared
+// geometry. instances outside the view frustum are skipped. the vertices and
+// indices of all geometries are packed into one arena buffer, and the whole
+// scene is submitted with a single glMultiDrawElementsIndirect, one command
+// per unique geometry. the per-instance model matrices are streamed into one
+// buffer every frame, and every command selects its instances through
+// baseInstance.
+// with impostors enabled, spheres and cylinders are not drawn as meshes but
+// as a proxy box per instance, in which a shader ray-casts the exact shape.
+class InstancedScene
+{
+  public:
+    InstancedScene ();
+    ~InstancedScene ();
+
+    // which instances render () draws: all of them, or only those whose
+    // Renderable::is_static flag is set / not set
+    enum Layer {ALL_LAYERS, STATIC_LAYER, DYNAMIC_LAYER};
+
+    // draw spheres and cylinders with renderImpostors () instead of their
+    // tessellation, takes effect on the next build ()
+    void setImpostors (bool enabled) {impostors_ = enabled;}
+
+    // groups the renderables of all renderers by geometry and packs the
+    // geometry, call this whenever the set of models changes. does not need
+    // a GL context, the buffers are uploaded on the next render ().
+    void build (const std::vector<URDFRenderer*> &renderers);
+
+    // culls all instances of the layer against the frustum, uploads the
+    // model matrices of the visible ones and draws the meshes. the shader
+    // has to read the model matrix from attributes 2-5.
+    void render (const Frustum &frustum, Layer layer = ALL_LAYERS);
+
+    // draws the visible instances of shape (Geometry::SPHERE or CYLINDER)
+    // of the layer culled by the last render () as a box from -1 to 1 around
+    // the unit shape. the shader gets the same attributes as in render ().
+    void renderImpostors (Geometry::Shape shape);
+
+    // statistics of the last build () / render ()
+    unsigned int numBatches () const {return batches_.size ();}
+    unsigned int numInstances () const {return num_instances_;}
+    unsigned int numDrawCalls () const {return num_draw_calls_;}
+    unsigned int numCulled () const {return num_culled_;}
+    unsigned int numImpostors () const {return num_impostors_;}
+
+  protected:
+    // creates the arena, instance and indirect buffers
+    void upload ();
+
+    // points the model matrix attributes at the given instance
+    void setInstanceOffset (unsigned int instance);
+
+    // draws commands [begin, end) one by one, needs the VAO bound
+    void drawCommands (unsigned int begin, unsigned int end);
+
+    // spheres and cylinders are drawn as impostors
+    static bool isImpostor (const Geometry &geometry);
+
+    struct Batch
+    {
+      boost::shared_ptr<Geometry> geometry;
+      std::vector<Renderable*> instances;
+    };
+
+    // layout defined by ARB_draw_indirect
+    struct DrawCommand
+    {
+      GLuint count;
+      GLuint instance_count;
+      GLuint first_index;
+      GLint base_vertex;
+      GLuint base_instance;
+    };
+
+    // mesh batches come first, impostor batches (one per shape) last
+    std::vector<Batch> batches_;
+    std::vector<DrawCommand> commands_;
+    unsigned int num_mesh_batches_;
+    bool impostors_;
+    unsigned int num_impostors_;
+    unsigned int num_instances_;
+    unsigned int num_draw_calls_;
+    unsigned int num_culled_;
+
+    // packed geometry of all batches
+    std::vector<Geometry::Vertex> vertices_;
+    std::vector<unsigned int> indices_;
+
+    // model matrices of all visible instances, batch after batch
+    std::vector<GLfloat> matrices_;
+
+    bool uploaded_;
+    GLuint vao_;
+    GLuint vertex_vbo_;
+    GLuint index_vbo_;
+    GLuint instance_vbo_;
+    GLuint indirect_buffer_;
+};
+
+} // end namespace
+
+#endif
@@ -0,0 +1,118 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REALTIME_URDF_FILTER_KINEMATICS_H_
+#define REALTIME_URDF_FILTER_KINEMATICS_H_
+
+#include <urdf/model.h>
+#include <sensor_msgs/JointState.h>
+#include <tf/tf.h>
+#include <boost/thread/mutex.hpp>
+#include <map>
+
+namespace realtime_urdf_filter
+{
+
+struct CompiledModel;
+
+// forward kinematics of one URDF model. the joint tree is flattened into
+// arrays in topological order (parents before children), so all link poses
+// are computed in one pass from the pose of the root link and the joint
+// positions received so far. mimic joints follow the joint they mimic,
+// floating and planar joints are treated as fixed.
+class Kinematics
+{
+  public:
+    Kinematics ();
+
+    void init (const urdf::Model &model);
+    void init (const CompiledModel &model);
+
+    const std::string& rootLink () const {return root_link_;}
+    unsigned int numLinks () const {return parents_.size ();}
+
+    // index of a link in the pose array, -1 if unknown
+    int linkIndex (const std::string &link) const;
+
+    // merges the positions of all known joints into the stored state, the
+    // others (and mimic joints) are ignored. can be called from any thread
+    void setJointState (const sensor_msgs::JointState &state);
+
+    // true once a JointState has been received and every joint that moves
+    // on its own has a position
+    bool hasJointState ();
+
+    // poses of all links in the fixed frame, given the root link's pose
+    void computeLinkPoses (const tf::Transform &root_to_fixed, std::vector<tf::Transform> &poses);
+
+  private:
+    // parent has to be added before its children
+    void addLink (const std::string &name, int parent, const std::string &joint_name,
+                  int joint_type, const tf::Transform &origin, const tf::Vector3 &axis);
+    void addSubtree (const urdf::Link &link, int parent);
+
+    // turns the mimic joints collected by addSubtree () into position
+    // indices, chains of mimic joints are folded into one step
+    void resolveMimicJoints ();
+
+    std::string root_link_;
+    std::map<std::string, int> link_indices_;
+    std::map<std::string, int> joint_indices_;
+
+    // per link: parent index (-1 for the root), type of the joint to the
+    // parent, its origin and axis, and the index of its position (-1 for
+    // joints that do not move)
+    std::vector<int> parents_;
+    std::vector<int> joint_types_;
+    std::vector<tf::Transform> origins_;
+    std::vector<tf::Vector3> axes_;
+    std::vector<int> position_indices_;
+
+    // per position: index of the position it mimics (-1 if it moves on its
+    // own), and the multiplier and offset applied to it
+    std::vector<int> mimic_sources_;
+    std::vector<double> mimic_multipliers_;
+    std::vector<double> mimic_offsets_;
+    // per position: the name of the joint it mimics, until resolved
+    std::map<int, std::string> mimic_joint_names_;
+
+    // written by setJointState (), copied once per computeLinkPoses ()
+    boost::mutex mutex_;
+    std::vector<double> positions_;
+    std::vector<double> current_;
+    std::vector<bool> received_;
+    bool has_joint_state_;
+    // positions that move on their own and have not been received yet
+    unsigned int num_missing_;
+};
+
+} // end namespace
+
+#endif
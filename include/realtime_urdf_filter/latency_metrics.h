@@ -0,0 +1,131 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REALTIME_URDF_FILTER_LATENCY_METRICS_H_
+#define REALTIME_URDF_FILTER_LATENCY_METRICS_H_
+
+#include <ros/time.h>
+#include <diagnostic_msgs/DiagnosticStatus.h>
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace realtime_urdf_filter
+{
+
+// keeps a rolling window of latency samples per processing stage, plus
+// a set of plain counters, and computes percentiles over them
+class LatencyMetrics
+{
+  public:
+    struct Stats
+    {
+      Stats () : count (0), mean (0), p50 (0), p95 (0), p99 (0), max (0) {}
+      size_t count;
+      double mean, p50, p95, p99, max;
+    };
+
+    LatencyMetrics (size_t window_size = 300);
+
+    // add a sample (in seconds) to the rolling window of a stage
+    void addSample (const std::string &stage, double seconds);
+
+    // set / increment a counter, e.g. number of culled renderables
+    void setCounter (const std::string &name, double value);
+    void incrementCounter (const std::string &name, double value = 1.0);
+
+    // percentiles over the current window of a stage
+    Stats getStats (const std::string &stage) const;
+
+    // stage names in the order they were first seen
+    const std::vector<std::string>& getStages () const {return stage_names_;}
+
+    // write all stages (in milliseconds) and counters into a diagnostic status
+    void toDiagnostics (diagnostic_msgs::DiagnosticStatus &status) const;
+
+    // human readable summary, one line per stage
+    void print (std::ostream &os) const;
+
+    // forget all samples and counters
+    void clear ();
+
+    // forget the samples of all stages and keep window_size samples per
+    // stage from now on, the counters stay
+    void clearSamples (size_t window_size);
+
+  private:
+    struct Window
+    {
+      Window () : next (0) {}
+      std::vector<double> samples;
+      size_t next;
+    };
+
+    size_t window_size_;
+    std::map<std::string, Window> stages_;
+    std::vector<std::string> stage_names_;
+    std::map<std::string, double> counters_;
+    std::vector<std::string> counter_names_;
+};
+
+// measures the wall time between construction (or restart) and stop () / destruction
+class ScopedStageTimer
+{
+  public:
+    ScopedStageTimer (LatencyMetrics &metrics, const std::string &stage)
+      : metrics_ (metrics), stage_ (stage), start_ (ros::WallTime::now ()), running_ (true)
+    {}
+
+    ~ScopedStageTimer ()
+    {
+      stop ();
+    }
+
+    // record the sample now instead of at the end of the scope
+    void stop ()
+    {
+      if (!running_)
+        return;
+      metrics_.addSample (stage_, (ros::WallTime::now () - start_).toSec ());
+      running_ = false;
+    }
+
+  private:
+    LatencyMetrics &metrics_;
+    std::string stage_;
+    ros::WallTime start_;
+    bool running_;
+};
+
+} // end namespace
+
+#endif
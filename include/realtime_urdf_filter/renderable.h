@@ -31,7 +31,7 @@
 #ifndef REALTIME_PERCEPTION_RENDERABLE_H_
 #define REALTIME_PERCEPTION_RENDERABLE_H_
 
-#include <GL3/gl3.h>
+#include <GL/glew.h>
 #include <tf/tf.h>
 // this is necessary for diamondback. for more recent ROS versions, use:
 // #include <urdf_interface/color.h>
@@ -44,12 +44,64 @@ struct aiMesh;
 namespace realtime_urdf_filter
 {
 
+// vertex and index data of an indexed triangle mesh in its link frame.
+// geometry only lives on the CPU, and can be created without a GL context.
+// renderables with identical geometry (e.g. the same robot loaded with
+// different tf_prefixes) share one Geometry from the AssetCache,
+// InstancedScene packs all of them into one GPU buffer.
+struct Geometry
+{
+  // what the vertices approximate. spheres and cylinders can also be drawn
+  // exactly, as ray-cast impostors (see InstancedScene)
+  enum Shape {MESH, BOX, SPHERE, CYLINDER};
+
+  Geometry () : shape (MESH), bounds_radius (-1.0) {}
+
+  // triangle soup (3 xyz vertices per triangle), generated on first use.
+  // used by the software rasterizer.
+  const std::vector<float>& getTriangles ();
+
+  // bounding sphere around all vertices, computed on first use
+  void getBoundingSphere (tf::Vector3 &center, double &radius);
+
+  // axis aligned bounding box of all vertices, computed on every call
+  void getBoundingBox (tf::Vector3 &min_pt, tf::Vector3 &max_pt) const;
+
+  struct Vertex
+  {
+    float x,y,z;
+    float nx,ny,nz;
+    Vertex (float x, float y, float z, float nx, float ny, float nz)
+      : x(x), y(y), z(z), nx(nx), ny(ny), nz(nz)
+    {}
+  };
+
+  Shape shape;
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> indices;
+  std::vector<float> triangles;
+
+  // cached bounding sphere, radius is negative until computed
+  tf::Vector3 bounds_center;
+  double bounds_radius;
+};
+
 struct Renderable
 { 
+  Renderable ();
+  virtual ~Renderable () {}
+
   void setLinkName (std::string n);
-  virtual void render () = 0;
   std::string name;
 
+  // model matrix (link to fixed frame, including link offset and scale),
+  // column major
+  void getModelMatrix (GLfloat* m) const;
+  void getModelMatrix (double* m) const;
+
+  // bounding sphere in the fixed frame, includes link offset and scale
+  void getBoundingSphere (tf::Vector3 &center, double &radius) const;
+
 //  tf::Vector3 offset_t;
 //  tf::Quaternion offset_q;
 //  tf::Vector3 t;
@@ -58,29 +110,40 @@ struct Renderable
   tf::Transform link_offset;
   tf::Transform link_to_fixed;
   tf::Transform fixed_to_target;
+  tf::Vector3 scale;
+
+  // link_to_fixed of the last frame, and for how many frames in a row it
+  // did not change. renderables that are static long enough are drawn into
+  // the cached static layer of the filter (see InstancedScene::Layer)
+  tf::Transform previous_link_to_fixed;
+  unsigned int unchanged_frames;
+  bool is_static;
+
+  // link_to_fixed the last geometry pass of the filter was drawn with
+  tf::Transform rendered_link_to_fixed;
 
   urdf::Color color;
-  void applyTransform ();
-  void unapplyTransform ();
+
+  // shared mesh data, never NULL
+  boost::shared_ptr<Geometry> geometry;
 };
 
 struct RenderableBox : public Renderable
 {
   RenderableBox (float dimx, float dimy, float dimz);
 
-  virtual void render ();
+  // fills in the shared unit cube
+  static bool createGeometry (Geometry &geometry);
 
   float dimx, dimy, dimz;
-protected: 
-  void createBoxVBO ();
-  GLuint vbo;
 };
 
 struct RenderableSphere : public Renderable
 {
   RenderableSphere (float radius);
 
-  virtual void render ();
+  // fills in the shared unit sphere
+  static bool createGeometry (Geometry &geometry);
 
   float radius;
 };
@@ -89,7 +152,8 @@ struct RenderableCylinder : public Renderable
 {
   RenderableCylinder (float radius, float length);
 
-  virtual void render ();
+  // fills in the shared unit cylinder
+  static bool createGeometry (Geometry &geometry);
 
   float radius;
   float length;
@@ -100,37 +164,13 @@ struct RenderableMesh : public Renderable
 {
   RenderableMesh (std::string meshname);
 
-  virtual void render ();
   void setScale (float x, float y, float z);
 
 private:
-  struct Vertex
-  {
-    float x,y,z;
-    float nx,ny,nz;
-    Vertex (float x, float y, float z, float nx, float ny, float nz)
-      : x(x), y(y), z(z), nx(nx), ny(ny), nz(nz)
-    {}
-  };
-
-  struct SubMesh
-  {
-    enum {INVALID_VALUE = 0xFFFFFFFF};
-    SubMesh ();
-    ~SubMesh ();
-    void init (const std::vector<Vertex>& vertices,
-               const std::vector<unsigned int>& indices);
-    GLuint vbo, ibo;
-    unsigned int num_indices;
-  };
-
-  void fromAssimpScene (const aiScene* scene);
-  void initMesh (unsigned int i, const aiMesh* mesh);
-
-  std::vector<SubMesh> meshes;
-  double scale_x;
-  double scale_y;
-  double scale_z;
+  // imports the mesh file, called by the AssetCache until it succeeds
+  static bool importGeometry (const std::string &meshname, Geometry &geometry);
+  static void fromAssimpScene (const aiScene* scene, Geometry &geometry);
+  static void initMesh (const aiMesh* mesh, Geometry &geometry);
 };
 
 
@@ -138,4 +178,3 @@ private:
 } // end namespace
 
 #endif
-
@@ -0,0 +1,224 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REALTIME_URDF_FILTER_SCENE_BUNDLE_H_
+#define REALTIME_URDF_FILTER_SCENE_BUNDLE_H_
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+namespace realtime_urdf_filter
+{
+
+// precompiled URDF models and their geometry, written by urdf_filter_bundle:
+//   SceneBundleHeader, followed by
+//   num_models      BundleModel
+//   num_links       BundleLink     (all links of all models)
+//   num_geometries  BundleGeometry
+//   num_vertices    6 floats       (Geometry::Vertex, position and normal)
+//   num_indices     uint32_t       (relative to the geometry's first vertex)
+//   strings_size    chars          (null terminated strings, referenced by offset)
+// all records only contain 4 byte fields (8 for the hash), so every section
+// is properly aligned in the mapped file.
+struct SceneBundleHeader
+{
+  char magic[8];          // "RUFSCENE"
+  uint32_t version;       // 1
+  uint32_t num_models;
+  uint32_t num_links;
+  uint32_t num_geometries;
+  uint32_t num_vertices;
+  uint32_t num_indices;
+  uint32_t strings_size;
+  uint32_t reserved;
+};
+
+// one URDF description. models are matched by the hash and size of the
+// description, so a changed URDF is simply parsed again
+struct BundleModel
+{
+  uint64_t description_hash;
+  uint32_t description_size;
+  uint32_t name;          // robot name
+  uint32_t first_link;
+  uint32_t num_links;
+};
+
+// one link and the joint to its parent. transforms are x y z qx qy qz qw
+struct BundleLink
+{
+  uint32_t name;
+  int32_t parent;         // index relative to the model's first link, -1 for the root
+  uint32_t joint_name;
+  uint32_t joint_type;    // urdf::Joint::type
+  float joint_origin[7];  // parent link to joint
+  float joint_axis[3];
+  int32_t geometry;       // -1 if the link has no visual
+  float visual_origin[7]; // link to visual
+  float scale[3];         // of the unit geometry
+  float color[4];
+};
+
+struct BundleGeometry
+{
+  uint32_t key;           // AssetCache key, e.g. "mesh package://..."
+  uint32_t shape;         // Geometry::Shape
+  uint32_t first_vertex;
+  uint32_t num_vertices;
+  uint32_t first_index;
+  uint32_t num_indices;
+};
+
+// 64 bit FNV-1a, stable across platforms and boost versions
+inline uint64_t hashDescription (const std::string &description)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < description.size (); ++i)
+  {
+    hash ^= (unsigned char) description[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// read-only, memory mapped view of a scene bundle
+class SceneBundleFile
+{
+  public:
+    SceneBundleFile ()
+      : data_ (NULL), size_ (0), header_ (NULL)
+    {}
+
+    ~SceneBundleFile ()
+    {
+      close ();
+    }
+
+    // maps the file into memory, returns false if it is not a valid bundle
+    bool open (const std::string &file_name)
+    {
+      close ();
+      int fd = ::open (file_name.c_str (), O_RDONLY);
+      if (fd < 0)
+        return false;
+
+      struct stat st;
+      if (fstat (fd, &st) != 0 || st.st_size < (off_t) sizeof(SceneBundleHeader))
+      {
+        ::close (fd);
+        return false;
+      }
+
+      void* data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close (fd);
+      if (data == MAP_FAILED)
+        return false;
+
+      data_ = (const unsigned char*) data;
+      size_ = st.st_size;
+      header_ = (const SceneBundleHeader*) data_;
+
+      if (memcmp (header_->magic, "RUFSCENE", 8) != 0 || header_->version != 1 || size_ < expectedSize (*header_))
+      {
+        close ();
+        return false;
+      }
+      return true;
+    }
+
+    void close ()
+    {
+      if (data_)
+        munmap ((void*) data_, size_);
+      data_ = NULL;
+      size_ = 0;
+      header_ = NULL;
+    }
+
+    // file size for the counts in the header
+    static size_t expectedSize (const SceneBundleHeader &h)
+    {
+      return sizeof(SceneBundleHeader)
+           + (size_t) h.num_models * sizeof(BundleModel)
+           + (size_t) h.num_links * sizeof(BundleLink)
+           + (size_t) h.num_geometries * sizeof(BundleGeometry)
+           + (size_t) h.num_vertices * 6 * sizeof(float)
+           + (size_t) h.num_indices * sizeof(uint32_t)
+           + h.strings_size;
+    }
+
+    const SceneBundleHeader& header () const {return *header_;}
+
+    // the sections, directly in the mapped file
+    const BundleModel* models () const
+    {
+      return (const BundleModel*) (data_ + sizeof(SceneBundleHeader));
+    }
+    const BundleLink* links () const
+    {
+      return (const BundleLink*) (models () + header_->num_models);
+    }
+    const BundleGeometry* geometries () const
+    {
+      return (const BundleGeometry*) (links () + header_->num_links);
+    }
+    const float* vertices () const
+    {
+      return (const float*) (geometries () + header_->num_geometries);
+    }
+    const uint32_t* indices () const
+    {
+      return (const uint32_t*) (vertices () + header_->num_vertices * 6);
+    }
+
+    // string at offset, empty if the offset is out of range
+    std::string string (uint32_t offset) const
+    {
+      const char* strings = (const char*) (indices () + header_->num_indices);
+      if (offset >= header_->strings_size)
+        return std::string ();
+      return std::string (strings + offset, strnlen (strings + offset, header_->strings_size - offset));
+    }
+
+  private:
+    const unsigned char* data_;
+    size_t size_;
+    const SceneBundleHeader* header_;
+};
+
+} // end namespace
+
+#endif
@@ -32,7 +32,11 @@
 #define REALTIME_PERCEPTION_SHADER_WRAPPER_H_
 
 #include <fstream>
+#include <map>
 #include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
 #define GL3_PROTOTYPES 1
 #include <GL3/gl3.h>
 
@@ -52,6 +56,11 @@ class ShaderWrapper
     static ShaderWrapper fromFiles (const std::string vertex_file, const std::string fragment_file);
     static ShaderWrapper fromFiles (const char* vertex_file, const char* fragment_file);
 
+    // compiles from files with the given preprocessor definitions (e.g.
+    // "#define FOO\n") inserted after the #version line of both shaders
+    static boost::shared_ptr<ShaderWrapper> create
+      (const std::string &vertex_file, const std::string &fragment_file, const std::string &defines);
+
     // make sure we delete everything upon deconstruction
     ~ShaderWrapper();
 
@@ -62,6 +71,11 @@ class ShaderWrapper
     void operator() ();
     void SetUniformVal1i(std::string name, GLint val);
     void SetUniformVal1f(std::string name, GLfloat val);
+    void SetUniformVal2f(std::string name, GLfloat x, GLfloat y);
+    void SetUniformVal4f(std::string name, GLfloat x, GLfloat y, GLfloat z, GLfloat w);
+
+    // connects a uniform block to a uniform buffer binding point
+    void BindUniformBlock(std::string name, GLuint binding);
 
   private:
     // templated constructor takes two char* arrays for vertex and fragment shader source code
@@ -75,10 +89,35 @@ class ShaderWrapper
     // loads a text file as a string
     static std::string load_text_file (std::string file_name);
 
+    // inserts defines after the #version line of source
+    static std::string inject_defines (const std::string &source, const std::string &defines);
+
     // handles to the shaders and the linked program
     GLuint vertex_shader, fragment_shader, prog;
 };
 
+// variants of one shader program, compiled with different sets of #defines.
+// a variant is identified by a bit mask over the list of flags, and is
+// compiled the first time it is requested
+class ShaderPermutations
+{
+  public:
+    ShaderPermutations (const std::string &vertex_file, const std::string &fragment_file,
+                        const std::vector<std::string> &flags);
+
+    // returns the variant with the flags set in key, created is set to true
+    // if it was compiled in this call
+    ShaderWrapper& get (unsigned key, bool &created);
+
+    // number of variants compiled so far
+    unsigned size () const;
+
+  private:
+    std::string vertex_file_, fragment_file_;
+    std::vector<std::string> flags_;
+    std::map<unsigned, boost::shared_ptr<ShaderWrapper> > variants_;
+};
+
 } // end namespace
 
 #endif
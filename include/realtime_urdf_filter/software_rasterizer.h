@@ -0,0 +1,114 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REALTIME_URDF_FILTER_SOFTWARE_RASTERIZER_H_
+#define REALTIME_URDF_FILTER_SOFTWARE_RASTERIZER_H_
+
+#include <realtime_urdf_filter/worker_pool.h>
+#include <vector>
+
+namespace realtime_urdf_filter
+{
+
+// renders triangles into a depth buffer on the CPU, and applies the same
+// comparison as urdf_filter.frag. follows OpenGL conventions: column major
+// matrices, window origin in the lower left corner, depth in [0,1] and
+// GL_LESS depth test. triangles are binned into screen tiles, and tiles are
+// rasterized in parallel using SSE edge functions (where available).
+class SoftwareRasterizer
+{
+  public:
+    // 0 threads means one per hardware thread
+    SoftwareRasterizer (unsigned int num_threads = 0);
+
+    void resize (int width, int height);
+
+    // set projection matrix (column major, like glLoadMatrixd)
+    void setProjection (const double* projection);
+
+    // start a new frame, clearing depth to the given window depth value
+    void clear (float depth);
+
+    // transforms, clips and bins a triangle soup (3 xyz vertices per
+    // triangle) with the given column major modelview matrix
+    void addTriangles (const std::vector<float> &xyz, const double* modelview);
+
+    // rasterizes all binned triangles
+    void rasterize ();
+
+    // per pixel comparison of virtual and sensor depth, like urdf_filter.frag.
+    // out_mask is 255 wherever a triangle was rendered and may be NULL.
+    void compare (const float* sensor_depth, float z_near, float z_far,
+                  float max_diff, float replace_value,
+                  float* out_depth, unsigned char* out_mask);
+
+    // window depth of a point at distance z in front of the camera
+    float windowDepth (double z) const;
+
+  private:
+    enum {TILE_SIZE = 32};
+
+    // screen space triangle: three edge functions a*x + b*y + c >= bias
+    // and the depth plane z = za*x + zb*y + zc
+    struct Triangle
+    {
+      float ea[3], eb[3], ec[3], bias[3];
+      float za, zb, zc;
+      int x0, y0, x1, y1;
+    };
+
+    void setupTriangle (const float* v0, const float* v1, const float* v2);
+    void rasterizeTile (unsigned int tile);
+    void compareRows (unsigned int chunk);
+
+    int width_, height_, stride_;
+    int tiles_x_, tiles_y_;
+    double projection_[16];
+
+    std::vector<float> depth_;
+    std::vector<unsigned char> coverage_;
+    std::vector<Triangle> triangles_;
+    std::vector<std::vector<unsigned int> > bins_;
+
+    // arguments of the current compare () call, for the worker jobs
+    struct CompareArgs
+    {
+      const float* sensor_depth;
+      float z_near, z_far, max_diff, replace_value;
+      float* out_depth;
+      unsigned char* out_mask;
+    } compare_args_;
+
+    WorkerPool pool_;
+};
+
+} // end namespace
+
+#endif
@@ -35,11 +35,16 @@
 #include <sensor_msgs/Image.h>
 #include <sensor_msgs/CameraInfo.h>
 #include <tf/transform_listener.h>
+#include <boost/thread.hpp>
 
 #include <opencv2/opencv.hpp>
 
 #include "realtime_urdf_filter/FrameBufferObject.h"
+#include "realtime_urdf_filter/context_backend.h"
+#include "realtime_urdf_filter/instanced_scene.h"
+#include "realtime_urdf_filter/latency_metrics.h"
 #include "realtime_urdf_filter/shader_wrapper.h"
+#include "realtime_urdf_filter/software_rasterizer.h"
 #include "realtime_urdf_filter/urdf_renderer.h"
 
 #include <GL/freeglut.h>
@@ -53,27 +58,46 @@ class RealtimeURDFFilter
     // constructor. sets up ros and reads in parameters
     RealtimeURDFFilter (ros::NodeHandle &nh, int argc, char **argv);
 
+    // constructor for offline use without a ROS master. parameters keep their
+    // defaults unless changed through the public members before initGL (),
+    // models are added with addModel () and TF data comes from tf
+    RealtimeURDFFilter (tf::Transformer &tf, int argc, char **argv);
+
     ~RealtimeURDFFilter ();
 
+    // adds a URDF model in addition to the ones from the "models" parameter
+    void addModel (const std::string &description, const std::string &tf_prefix);
+
     // loads URDF models
     void loadModels ();
 
-    // helper function to get current time
-    double getTime ();
-
     // callback function that gets ROS images and does everything
     void filter_callback
          (const sensor_msgs::ImageConstPtr& ros_depth_image,
           const sensor_msgs::CameraInfo::ConstPtr& camera_info);
 
-    // does virtual rendering and filtering based on depth buffer and opengl proj. matrix
-    void filter (unsigned char* buffer, double* glTf, int width, int height, ros::Time timestamp = ros::Time::now());
+    // does virtual rendering and filtering based on depth buffer and opengl proj. matrix.
+    // step is the size of an image row in bytes, 0 if the rows are packed
+    void filter (unsigned char* buffer, double* glTf, int width, int height, ros::Time timestamp = ros::Time::now(),
+                 int step = 0);
+
+    // same for raw 16 bit depth in millimeters (16UC1, 0 = no measurement),
+    // which is uploaded as it is and converted to meters on the GPU
+    void filter (const unsigned short* buffer, double* glTf, int width, int height,
+                 ros::Time timestamp = ros::Time::now(), int step = 0);
 
-    // copy cv::Mat1f to char buffer
-    unsigned char* bufferFromDepthImage (cv::Mat1f depth_image);
+    // copy the rows of a cv::Mat into one continuous buffer, if they are not
+    // already. the cpu backend and the sparse readback need this, and the
+    // upload does when the row stride is not a whole number of pixels
+    unsigned char* bufferFromDepthImage (cv::Mat depth_image);
 
-    // copy char buffer to OpenGL texture
-    void textureBufferFromDepthBuffer (unsigned char* buffer, int size_in_bytes);
+    // copy an image with rows of step bytes (a multiple of the pixel size)
+    // into the OpenGL texture of the next upload slot, format is GL_R32F or
+    // GL_R16UI
+    void textureFromDepthBuffer (const unsigned char* buffer, int step, GLenum format = GL_R32F);
+
+    // (re)create the ring of depth upload buffers and their textures
+    void initUploadRing (int size_in_bytes, GLenum format);
 
     // set up OpenGL stuff
     void initGL ();
@@ -81,39 +105,209 @@ class RealtimeURDFFilter
     // set up FBO
     void initFrameBufferObject ();
 
+    // set up camera uniform buffer and the screen quad vertex buffer
+    void initDrawBuffers ();
+
     // compute Projection matrix from CameraInfo message
     void getProjectionMatrix (const sensor_msgs::CameraInfo::ConstPtr& current_caminfo, double* glTf);
 
-    void render (const double* camera_projection_matrix);
+    // renders and filters into fbo_, returns false if nothing was rendered
+    // (no context, or TF failed)
+    bool render (const double* camera_projection_matrix);
+
+    // renders and filters on the CPU, writes masked_depth_ / mask_ directly.
+    // returns false if TF failed
+    bool renderCPU (const float* depth, const double* camera_projection_matrix);
+
+    // looks up camera and link transforms, returns false if TF failed
+    bool updateTransforms (tf::StampedTransform &camera_to_fixed);
+
+    // transformation from "fixed frame" to OpenGL eye coordinates
+    tf::Transform getViewTransform (const tf::Transform &camera_to_fixed);
+
+    // blocking readback of filtered depth and mask into host memory
+    void readback ();
+
+    // (re)create the tile occupancy image for the sparse readback
+    void initTiles ();
+
+    // (re)create the depth texture and FBO of the static layer
+    void initStaticLayer ();
+
+    // classifies the renderables into static and dynamic ones, and
+    // invalidates the static layer if that or the camera changed. returns
+    // false if the static layer is not used at all
+    bool updateStaticLayer (const tf::Transform &view, const double* camera_projection_matrix);
 
+    // copies the depth of fbo_ and the marked tiles into the static layer
+    void saveStaticLayer ();
+
+    // blits the depth buffer of framebuffer src into dst, leaves fbo_ bound
+    void copyDepth (GLuint src, GLuint dst);
+
+    // true if the depth of the last geometry pass can be used for this
+    // frame. otherwise remembers the camera and link transforms the geometry
+    // pass is about to draw with
+    bool canReuseVirtualDepth (const tf::Transform &view, const double* camera_projection_matrix, unsigned outputs);
+
+    // true if no rotation or translation component of a and b differs by
+    // more than epsilon
+    static bool isNearlyEqual (const tf::Transform &a, const tf::Transform &b, double epsilon);
+
+    // blocking readback of the occupied tiles only, the other pixels are
+    // filtered against the background on the CPU. depth is the sensor image
+    // passed to filter ()
+    void readbackSparse (const unsigned char* depth);
+
+    // asynchronous readback: start transferring the current frame into a
+    // pixel pack buffer, and collect the results of the previous frame along
+    // with the outputs that were read back for it
+    void startReadback (ros::Time timestamp);
+    bool finishReadback (ros::Time &timestamp, bool &has_depth, bool &has_mask);
+
+    // publish processed depth image and image mask, those that were computed
+    // for this frame and have subscribers
+    void publishResults (ros::Time timestamp, bool has_depth, bool has_mask);
+
+    // publish latency percentiles on /diagnostics, at most every diagnostics_period_
+    void publishDiagnostics ();
+
+    // filtered depth in meters, not written by the GPU with 16 bit output
     GLfloat* getMaskedDepth()
       {return masked_depth_;}
     
+  protected:
+    // sets all members that are not read from the parameter server
+    void setDefaults ();
+
+    // filter () for both depth formats, input_16u_ tells which one buffer is
+    void filterImage (const unsigned char* buffer, double* glTf, int width, int height, ros::Time timestamp,
+                      int step);
+
+    // 16 bit depth images hold millimeters, 0 means no measurement (NaN in
+    // meters). meters are rounded and clamped to [0, UNCOVERED_16U - 1]
+    static float millimetersToMeters (GLushort depth);
+    static GLushort metersToMillimeters (float depth);
+
+    // reads (description, tf_prefix) pairs from the "models" parameter, and
+    // the joint state topics of the models that have one, by tf_prefix
+    void readModelParameters (std::vector<std::pair<std::string, std::string> > &models,
+                              std::map<std::string, std::string> &joint_state_topics);
+
+    // parses model i into the AssetCache, a WorkerPool job of loadModels ()
+    static void parseModelJob (const std::vector<std::pair<std::string, std::string> > *models, unsigned int i);
+
+    // the distinct visual mesh files of all parsed models
+    static void collectMeshes (const std::vector<std::pair<std::string, std::string> > &models,
+                               std::vector<std::string> &meshes);
+
+    // imports mesh i into the AssetCache, a WorkerPool job of loadModels ()
+    static void importMeshJob (const std::vector<std::string> *meshes, unsigned int i);
+
+    // builds scene_ from renderers_ and updates the counters
+    void buildScene ();
+
+    // progressive loading, see mesh_loader_
+    void loadPendingMeshes ();
+    void stopMeshLoader ();
+
   public:
-    // ROS objects
-    ros::NodeHandle &nh_;
-    tf::TransformListener tf_;
+    // ROS objects, nh_ is NULL when running offline
+    ros::NodeHandle *nh_;
+    boost::shared_ptr<tf::TransformListener> tf_listener_;
+    tf::Transformer *tf_;
     ros::Publisher mask_pub_;
     ros::Publisher depth_pub_;
+    ros::Publisher diagnostics_pub_;
+
+    // per-stage latency metrics
+    LatencyMetrics metrics_;
+    double diagnostics_period_;
+    ros::WallTime last_diagnostics_;
+    unsigned frames_since_diagnostics_;
+
+    // GL_TIME_ELAPSED queries, double buffered. results are only read once
+    // available, so we never wait for the GPU
+    GLuint gpu_timer_query_[2];
+    bool gpu_timer_pending_[2];
+    int gpu_timer_index_;
 
     // rendering objects
+    bool cpu_render_;
+    unsigned cpu_render_threads_;
+    SoftwareRasterizer *rasterizer_;
+    ContextBackend *context_;
     FramebufferObject *fbo_;
     bool fbo_initialized_;
-    GLuint depth_image_pbo_;
-    GLuint depth_texture_;
+
+    // color attachments of fbo_, the debug attachments (sensor depth and
+    // normals) only exist when the gui is shown
+    enum {FILTERED_ATTACHMENT = 0, MASK_ATTACHMENT, SENSOR_ATTACHMENT, NORMAL_ATTACHMENT};
+
+    // outputs of the filter shader variants, bits of the ShaderPermutations
+    // key. the compare pass additionally has variants for 16 bit input and
+    // output images
+    enum {OUTPUT_DEPTH = 1, OUTPUT_MASK = 2, OUTPUT_DEBUG = 4, INPUT_16U = 8, OUTPUT_16U = 16};
+
+    // uniform buffer with projection and view matrix, updated once per frame
+    GLuint camera_ubo_;
+
+    // cached geometry: unit square for the compare pass and the gui
+    GLuint quad_vao_, quad_vbo_;
+
+    // ring of depth upload buffers, so that the copy of frame N+1 can overlap
+    // with the rendering of frame N. every slot is a pixel unpack buffer with
+    // the image rows as they come (any stride), its own 2D texture and a
+    // fence that signals when the GPU is done reading from it.
+    enum {UPLOAD_RING_SIZE = 3};
+    GLuint depth_image_pbo_[UPLOAD_RING_SIZE];
+    GLuint depth_texture_[UPLOAD_RING_SIZE];
+    GLsync upload_fence_[UPLOAD_RING_SIZE];
+    unsigned char* upload_ptr_[UPLOAD_RING_SIZE];
+    int upload_slot_;
+    int upload_size_;
+    GLenum upload_format_;
+    bool persistent_upload_;
+
+    // continuous copy of sensor images with padded rows, for the CPU
+    std::vector<unsigned char> packed_depth_;
 
     // vector of renderables
     std::vector<URDFRenderer*> renderers_;
 
+    // JointState subscribers of the renderers that use forward kinematics
+    std::vector<ros::Subscriber> joint_state_subs_;
+
+    // renderables of all renderers, batched by geometry
+    InstancedScene scene_;
+
+    // draw spheres and cylinders as ray-cast impostors
+    bool primitive_impostors_;
+
+    // progressive loading: links start out as their collision primitives,
+    // mesh_loader_ imports the meshes in the background
+    bool progressive_loading_;
+    boost::thread mesh_loader_;
+
+    // models added through addModel (), as (description, tf_prefix)
+    std::vector<std::pair<std::string, std::string> > model_descriptions_;
+
     // parameters from launch file
     tf::Vector3 camera_offset_t_;
     tf::Quaternion camera_offset_q_;
     std::string cam_frame_;
     std::string fixed_frame_;
+    std::string context_backend_;
     bool show_gui_;
 
-    // do we have subscribers for the mask image?
+    // do we have subscribers for the mask / depth image?
     bool need_mask_;
+    bool need_depth_;
+
+    // compute these outputs even without subscribers (e.g. for the tracker,
+    // which reads getMaskedDepth () directly, or for benchmarks)
+    bool force_depth_output_;
+    bool force_mask_output_;
 
     // image size
     GLint width_;
@@ -132,6 +326,61 @@ class RealtimeURDFFilter
     // output from rendering
     GLfloat* masked_depth_;
     GLubyte* mask_;
+
+    // 16 bit depth: input_16u_ is set if the sensor image of the current
+    // frame holds millimeters (converted to meters in the compare shader,
+    // or into cpu_depth_ for the software rasterizer). with output_16u_ the
+    // filtered depth is published as 16UC1. readback_16u_ is set if the GPU
+    // writes and reads back millimeters into masked_depth_16u_ directly,
+    // otherwise masked_depth_ is converted when publishing (cpu backend and
+    // gui). tiles without a model are marked with UNCOVERED_16U
+    enum {UNCOVERED_16U = 65535};
+    bool input_16u_;
+    bool output_16u_;
+    bool readback_16u_;
+    GLushort* masked_depth_16u_;
+    std::vector<float> cpu_depth_;
+
+    // deferred readback publishes frame N-1 while frame N is still rendering
+    bool deferred_readback_;
+    enum {READBACK_RING_SIZE = 2};
+    GLuint readback_pbo_[READBACK_RING_SIZE];
+    GLsync readback_fence_[READBACK_RING_SIZE];
+    ros::Time readback_stamp_[READBACK_RING_SIZE];
+    bool readback_has_mask_[READBACK_RING_SIZE];
+    bool readback_has_depth_[READBACK_RING_SIZE];
+    int readback_slot_;
+    int readback_size_;
+
+    // sparse readback: the filter shader marks every TILE_SIZE x TILE_SIZE tile
+    // it touches in tile_texture_, only those tiles are transferred
+    enum {TILE_SIZE = 16};
+    bool sparse_readback_;
+    GLuint tile_texture_;
+    int tiles_x_, tiles_y_;
+    std::vector<GLuint> tiles_;
+
+    // static layer: the depth of all renderables that did not move for
+    // STATIC_LAYER_FRAMES frames is rendered once into static_fbo_, and
+    // copied into fbo_ at the start of every frame while neither they nor
+    // the camera move. only the dynamic renderables are drawn on top
+    enum {STATIC_LAYER_FRAMES = 30};
+    bool static_layer_;
+    bool static_layer_valid_;
+    GLuint static_fbo_;
+    GLuint static_depth_texture_;
+    tf::Transform static_view_;
+    double static_projection_[16];
+    std::vector<GLuint> static_tiles_;
+
+    // temporal reuse: the geometry pass is skipped while the camera and all
+    // links stay within temporal_reuse_epsilon_ of the transforms it was last
+    // rendered with (Renderable::rendered_link_to_fixed). negative disables
+    double temporal_reuse_epsilon_;
+    bool virtual_depth_valid_;
+    unsigned virtual_depth_outputs_;
+    tf::Transform virtual_depth_view_;
+    double virtual_depth_projection_[16];
 };
 
 } // end namespace
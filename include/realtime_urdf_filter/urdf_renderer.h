@@ -34,6 +34,9 @@
 #include <urdf/model.h>
 #include <tf/transform_listener.h>
 #include <realtime_urdf_filter/renderable.h>
+#include <realtime_urdf_filter/asset_cache.h>
+#include <realtime_urdf_filter/kinematics.h>
+#include <boost/thread/mutex.hpp>
 
 // forward declares
 namespace ros {class NodeHandle;}
@@ -41,21 +44,74 @@ namespace ros {class NodeHandle;}
 namespace realtime_urdf_filter
 {
 
+class WorkerPool;
+
 class URDFRenderer
 { 
   public:
-    URDFRenderer (std::string model_description, std::string tf_prefix, std::string cam_frame, std::string fixed_frame, tf::TransformListener &tf);
-    void render ();
+    // with a pool, the links (and their meshes) are loaded in parallel. with
+    // defer_meshes, links with meshes that are not cached yet start out as
+    // their collision primitive (or not at all), see loadPendingLinks ()
+    URDFRenderer (std::string model_description, std::string tf_prefix, std::string cam_frame, std::string fixed_frame, tf::Transformer &tf,
+                  WorkerPool *pool = NULL, bool defer_meshes = false);
+    // updates the current link poses, call this before rendering. once a
+    // JointState was received, the root link is looked up in TF and all other
+    // links are computed from the joint positions, before that every link is
+    // looked up in TF
+    void update_link_transforms ();
+
+    // joint positions for the forward kinematics, e.g. from a JointState
+    // subscriber. can be called from any thread
+    void setJointState (const sensor_msgs::JointState::ConstPtr &state);
+
+    // the renderables of all links, with their current transforms
+    const std::vector<boost::shared_ptr<Renderable> >& getRenderables () const {return renderables_;}
+
+    // number of deferred links that have not been swapped in yet
+    unsigned int numPendingLinks () const {return pending_.size () - num_swapped_;}
+
+    // imports the meshes of all deferred links, blocks until done or
+    // cancelled. call this on a loader thread, not while rendering
+    void loadPendingLinks (WorkerPool *pool);
+
+    // makes the loaded links current, replacing their proxies. call this
+    // from the rendering thread, returns true if any renderable changed
+    bool swapLoadedLinks ();
+
+    // the remaining deferred links are not loaded any more
+    void cancelPendingLinks ();
+
+    // renderable for the visual of a link, with its offset and color but
+    // without a name. NULL if the link has no (supported) visual
+    static boost::shared_ptr<Renderable> createRenderable (const urdf::Link &link);
+
+    // renderable for a geometry at origin, NULL for unknown geometry types
+    static boost::shared_ptr<Renderable> createRenderable (const urdf::Geometry &geometry, const urdf::Pose &origin);
 
   protected:
-    void initURDFModel ();
-    void loadURDFModel (urdf::Model &descr);
-    void process_link (boost::shared_ptr<urdf::Link> link);
-    void update_link_transforms ();
+    void initURDFModel (WorkerPool *pool, bool defer_meshes);
+    void loadURDFModel (const urdf::Model &descr, WorkerPool *pool, bool defer_meshes);
+    void loadCompiledModel (const CompiledModel &model);
+    void updateLinkTransformsFromTF ();
+    static void processLinkJob (const std::vector<boost::shared_ptr<urdf::Link> > *links,
+                                std::vector<boost::shared_ptr<Renderable> > *renderables,
+                                unsigned int i);
+    void loadPendingJob (unsigned int i);
+
+    // true if the link has a mesh visual that is not in the AssetCache
+    static bool hasUncachedMesh (const urdf::Link &link);
+
+    // conservative stand-in for a deferred link: its collision geometry, if
+    // that is a primitive, or the bounding box of a cached collision mesh
+    static boost::shared_ptr<Renderable> createProxy (const urdf::Link &link);
 
     // urdf model stuff
     std::string model_description_;
     std::string tf_prefix_;
+    // shared with all renderers of the same description, only one of them
+    // is set: the compiled model if the description is in a scene bundle
+    boost::shared_ptr<const urdf::Model> model_;
+    boost::shared_ptr<const CompiledModel> compiled_model_;
     
     // camera stuff
     std::string camera_frame_;
@@ -63,7 +119,28 @@ class URDFRenderer
    
     // rendering stuff 
     std::vector<boost::shared_ptr<Renderable> > renderables_;
-    tf::TransformListener &tf_;
+    tf::Transformer &tf_;
+
+    // forward kinematics, and the link index of every renderable (rebuilt
+    // when renderables_ changes)
+    Kinematics kinematics_;
+    std::vector<int> renderable_links_;
+    std::vector<tf::Transform> link_poses_;
+
+    // deferred links: slot is the index of the proxy in renderables_ (-1 if
+    // there is none), loaded is set by the loader thread
+    struct PendingLink
+    {
+      boost::shared_ptr<urdf::Link> link;
+      int slot;
+      boost::shared_ptr<Renderable> loaded;
+    };
+    std::vector<PendingLink> pending_;
+    // indices of loaded, not yet swapped pending_ entries
+    std::vector<unsigned int> ready_;
+    unsigned int num_swapped_;
+    bool cancelled_;
+    boost::mutex pending_mutex_;
 };
 
 } // end namespace
@@ -0,0 +1,73 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef REALTIME_URDF_FILTER_WORKER_POOL_H_
+#define REALTIME_URDF_FILTER_WORKER_POOL_H_
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+namespace realtime_urdf_filter
+{
+
+// a fixed set of worker threads that process indexed jobs
+class WorkerPool
+{
+  public:
+    // 0 threads means one per hardware thread
+    WorkerPool (unsigned int num_threads = 0);
+    ~WorkerPool ();
+
+    // number of worker threads
+    unsigned int size () const {return num_threads_;}
+
+    // calls job (i) for every i in [0, count) on the workers and waits until
+    // all of them are done. must not be called from within a job.
+    void run (const boost::function<void (unsigned int)> &job, unsigned int count);
+
+  private:
+    void workerLoop ();
+
+    unsigned int num_threads_;
+    boost::thread_group threads_;
+    boost::mutex mutex_;
+    boost::condition_variable work_cond_;
+    boost::condition_variable done_cond_;
+
+    const boost::function<void (unsigned int)> *job_;
+    unsigned int next_;
+    unsigned int count_;
+    unsigned int pending_;
+    bool stop_;
+};
+
+} // end namespace
+
+#endif
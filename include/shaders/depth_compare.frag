@@ -0,0 +1,87 @@
+#version 330 core
+
+// compare pass: runs once per pixel after the geometry pass, and compares
+// the rendered depth to the sensor depth. outputs are enabled with
+// OUTPUT_DEPTH, OUTPUT_MASK and OUTPUT_DEBUG. with INPUT_16U the sensor depth
+// is raw millimeters (0 = no measurement), with OUTPUT_16U the filtered depth
+// is written as millimeters
+
+#ifdef INPUT_16U
+uniform usampler2D depth_texture;
+#else
+uniform sampler2D depth_texture;
+#endif
+uniform sampler2DRect virtual_depth_texture;
+
+uniform float replace_value;
+
+uniform float z_near;
+uniform float z_far;
+
+uniform float max_diff;
+
+// linear depth of pixels without a model, and whether to leave them alone
+uniform float background_depth;
+uniform bool skip_background;
+
+#ifdef OUTPUT_DEPTH
+#ifdef OUTPUT_16U
+layout(location = 0) out uint filtered_depth;
+#else
+layout(location = 0) out float filtered_depth;
+#endif
+#endif
+#ifdef OUTPUT_MASK
+layout(location = 1) out float mask;
+#endif
+#ifdef OUTPUT_DEBUG
+layout(location = 2) out float sensor_image;
+#endif
+
+float to_linear_depth (float d)
+{
+  return (z_near * z_far / (z_near - z_far)) / (d - z_far / (z_far - z_near));
+}
+
+void main(void)
+{
+  // window depth is still at the clear value where no model was drawn
+  float window_depth = texelFetch (virtual_depth_texture, ivec2 (gl_FragCoord.xy)).x;
+  bool covered = window_depth < 1.0;
+  if (!covered && skip_background)
+    discard;
+
+#if defined(OUTPUT_DEPTH) || defined(OUTPUT_DEBUG)
+#ifdef INPUT_16U
+  uint raw_depth = texelFetch (depth_texture, ivec2 (gl_FragCoord.xy), 0).x;
+  float sensor_depth = float (raw_depth) * 0.001;
+  bool measured = raw_depth != 0u;
+#else
+  // pixels without a measurement are NaN, they never pass the comparison
+  float sensor_depth = texelFetch (depth_texture, ivec2 (gl_FragCoord.xy), 0).x;
+  bool measured = true;
+#endif
+#endif
+
+#ifdef OUTPUT_DEPTH
+  // first color attachment: difference image
+  float virtual_depth = covered ? to_linear_depth (window_depth) : background_depth;
+  float filtered = (measured && virtual_depth - sensor_depth > max_diff) ? sensor_depth: replace_value;
+#ifdef OUTPUT_16U
+  // 65535 marks pixels without a model for the sparse readback
+  filtered_depth = uint (clamp (filtered * 1000.0 + 0.5, 0.0, 65534.0));
+#else
+  filtered_depth = filtered;
+#endif
+#endif
+
+#ifdef OUTPUT_MASK
+  // second color attachment: mask, set where a model is
+  mask = covered ? 1.0 : 0.0;
+#endif
+
+#ifdef OUTPUT_DEBUG
+  // debug attachment: sensor depth image
+  sensor_image = sensor_depth;
+#endif
+}
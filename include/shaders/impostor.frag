@@ -0,0 +1,128 @@
+#version 330 core
+#extension GL_ARB_shader_image_load_store : enable
+
+// geometry pass for spheres and cylinders: the proxy box is rasterized and
+// every fragment intersects its view ray with the exact unit shape, so the
+// depth does not depend on any tessellation. OUTPUT_DEBUG adds the normal
+// visualization for the gui, like in urdf_filter.frag
+
+// no early fragment tests here, the depth is only known after the ray cast
+#ifdef GL_ARB_shader_image_load_store
+uniform bool mark_tiles;
+uniform int tile_size;
+layout(r32ui) writeonly uniform uimage2D tiles;
+#endif
+
+layout(std140) uniform Camera
+{
+  mat4 projection;
+  mat4 view;
+};
+
+uniform bool cylinder;
+
+flat in vec3 ray_origin;
+in vec3 ray_point;
+flat in mat4 modelview;
+
+#ifdef OUTPUT_DEBUG
+layout(location = 3) out vec4 normal_color;
+#endif
+
+const float INF = 1e30;
+
+// interval [t0, t1] in which o + t * d lies inside the unit sphere
+bool intersectSphere (vec3 o, vec3 d, out float t0, out float t1)
+{
+  float a = dot (d, d);
+  float b = dot (o, d);
+  float c = dot (o, o) - 1.0;
+  float disc = b * b - a * c;
+  if (disc < 0.0)
+    return false;
+  float s = sqrt (disc);
+  t0 = (-b - s) / a;
+  t1 = (-b + s) / a;
+  return true;
+}
+
+// same for the unit cylinder, radius 1 around z, z = -0.5..0.5. cap tells
+// whether the ray enters through one of the caps
+bool intersectCylinder (vec3 o, vec3 d, out float t0, out float t1, out bool cap)
+{
+  // infinite cylinder, a ray parallel to the axis is either inside or not
+  float a = dot (d.xy, d.xy);
+  float b = dot (o.xy, d.xy);
+  float c = dot (o.xy, o.xy) - 1.0;
+  float side0 = -INF, side1 = INF;
+  if (a > 1e-12)
+  {
+    float disc = b * b - a * c;
+    if (disc < 0.0)
+      return false;
+    float s = sqrt (disc);
+    side0 = (-b - s) / a;
+    side1 = (-b + s) / a;
+  }
+  else if (c > 0.0)
+    return false;
+
+  // slab between the caps, again with a guard for rays parallel to them
+  float slab0 = -INF, slab1 = INF;
+  if (abs (d.z) > 1e-6)
+  {
+    float ta = (-0.5 - o.z) / d.z;
+    float tb = ( 0.5 - o.z) / d.z;
+    slab0 = min (ta, tb);
+    slab1 = max (ta, tb);
+  }
+  else if (abs (o.z) > 0.5)
+    return false;
+
+  t0 = max (side0, slab0);
+  t1 = min (side1, slab1);
+  cap = slab0 > side0;
+  return t0 <= t1;
+}
+
+void main(void)
+{
+  // not normalized, t = 1 is the proxy fragment itself
+  vec3 d = ray_point - ray_origin;
+
+  float t0, t1;
+  bool cap = false;
+  bool hit = cylinder ? intersectCylinder (ray_origin, d, t0, t1, cap)
+                      : intersectSphere (ray_origin, d, t0, t1);
+  if (!hit || t1 < 0.0)
+    discard;
+
+  // the camera is inside the shape, everything in this direction is covered
+  if (t0 < 0.0)
+  {
+    gl_FragDepth = gl_DepthRange.near;
+    t0 = 0.0;
+  }
+  else
+  {
+    vec4 clip = projection * modelview * vec4 (ray_origin + t0 * d, 1.0);
+    gl_FragDepth = (gl_DepthRange.diff * clip.z / clip.w + gl_DepthRange.near + gl_DepthRange.far) * 0.5;
+  }
+
+#ifdef OUTPUT_DEBUG
+  vec3 h = ray_origin + t0 * d;
+  vec3 object_normal = cylinder ? (cap ? vec3 (0.0, 0.0, sign (h.z)) : vec3 (h.xy, 0.0)) : h;
+  vec3 temp = normalize (mat3 (modelview) * object_normal);
+  vec3 normal = vec3 (-temp.x, temp.y, -temp.z);
+  normal_color = vec4 ((normal.x + 1.0) * 0.5,
+                       (normal.y + 1.0) * 0.5,
+                       (normal.z + 1.0) * 0.5,
+                       1.0);
+#endif
+
+#ifdef GL_ARB_shader_image_load_store
+  // this pixel is covered by a model, so its tile has to be read back
+  if (mark_tiles)
+    imageStore (tiles, ivec2 (gl_FragCoord.xy) / tile_size, uvec4 (1u));
+#endif
+}
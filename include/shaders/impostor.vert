@@ -0,0 +1,29 @@
+#version 330 core
+layout(location = 0) in vec3 vertex;
+
+// per instance model matrix, occupies locations 2-5
+layout(location = 2) in mat4 model;
+
+// set once per frame
+layout(std140) uniform Camera
+{
+  mat4 projection;
+  mat4 view;
+};
+
+// the proxy is a box from -1 to 1, the unit cylinder only spans z = -0.5..0.5
+uniform bool cylinder;
+
+// the ray through a fragment, in the object space of the unit shape
+flat out vec3 ray_origin;
+out vec3 ray_point;
+flat out mat4 modelview;
+
+void main() {
+  vec3 p = cylinder ? vec3 (vertex.xy, vertex.z * 0.5) : vertex;
+  modelview = view * model;
+  gl_Position = projection * modelview * vec4(p, 1.0);
+
+  ray_origin = (inverse (modelview) * vec4 (0.0, 0.0, 0.0, 1.0)).xyz;
+  ray_point = p;
+}
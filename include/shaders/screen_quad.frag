@@ -0,0 +1,20 @@
+#version 330 core
+in vec2 texcoord;
+
+// either draws a texture, or fills the quad with a constant color
+uniform bool textured;
+uniform bool single_channel;
+uniform sampler2DRect image;
+uniform vec4 color;
+
+out vec4 frag_color;
+
+void main(void)
+{
+  if (!textured)
+    frag_color = color;
+  else if (single_channel)
+    frag_color = vec4 (texture (image, texcoord).rrr, 1.0);
+  else
+    frag_color = texture (image, texcoord);
+}
@@ -0,0 +1,17 @@
+#version 330 core
+// corners of the unit square
+layout(location = 0) in vec2 position;
+
+// x0, y0, x1, y1 of the quad in window coordinates [0, 1]
+uniform vec4 rect;
+uniform vec2 texture_size;
+
+out vec2 texcoord;
+
+void main() {
+  vec2 p = mix (rect.xy, rect.zw, position);
+  gl_Position = vec4 (p * 2.0 - 1.0, 0.0, 1.0);
+
+  // show images upside down, the way the camera sees them
+  texcoord = vec2 (position.x, 1.0 - position.y) * texture_size;
+}
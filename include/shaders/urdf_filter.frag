@@ -1,40 +1,35 @@
-#version 140
-varying vec3 normal;
-uniform int width;
-uniform int height;
-uniform samplerBuffer depth_texture;
-
-uniform float replace_value;
-
-uniform float z_near;
-uniform float z_far;
-
-uniform float max_diff;
-
-float to_linear_depth (float d)
-{
-  return (z_near * z_far / (z_near - z_far)) / (d - z_far / (z_far - z_near));
-}
+#version 330 core
+#extension GL_ARB_shader_image_load_store : enable
+
+// geometry pass: the depth buffer is all that is needed from the models, the
+// comparison with the sensor happens once per pixel in depth_compare.frag.
+// OUTPUT_DEBUG adds the normal visualization for the gui
+
+// tile occupancy for the sparse readback, one texel per tile
+#ifdef GL_ARB_shader_image_load_store
+layout(early_fragment_tests) in;
+uniform bool mark_tiles;
+uniform int tile_size;
+layout(r32ui) writeonly uniform uimage2D tiles;
+#endif
+
+#ifdef OUTPUT_DEBUG
+in vec3 normal;
+layout(location = 3) out vec4 normal_color;
+#endif
 
 void main(void)
 {
-  // first color attachment: sensor depth image
-  float sensor_depth = texelFetch (depth_texture, int(gl_FragCoord.y)*width + int(gl_FragCoord.x)).x;
-  gl_FragData[0] = vec4 (sensor_depth, sensor_depth, sensor_depth, 1.0);
-
-  // second color attachment: opengl depth image
-  float virtual_depth = to_linear_depth (gl_FragCoord.z);
-  gl_FragData[1] = vec4 (virtual_depth, virtual_depth, virtual_depth, 1.0);
-
-  // third color attachment: normal visualization
-  gl_FragData[2] = vec4 ((normal.x + 1.0) * 0.5,
-                         (normal.y + 1.0) * 0.5,
-                         (normal.z + 1.0) * 0.5,
-                         1.0);
-
-  // fourth color attachment: difference image
-  float diff_col = (virtual_depth - sensor_depth > max_diff) ? sensor_depth: replace_value;
-  gl_FragData[1] = vec4 (diff_col, diff_col, diff_col, 1.0);
+#ifdef OUTPUT_DEBUG
+  normal_color = vec4 ((normal.x + 1.0) * 0.5,
+                       (normal.y + 1.0) * 0.5,
+                       (normal.z + 1.0) * 0.5,
+                       1.0);
+#endif
+
+#ifdef GL_ARB_shader_image_load_store
+  // this pixel is covered by a model, so its tile has to be read back
+  if (mark_tiles)
+    imageStore (tiles, ivec2 (gl_FragCoord.xy) / tile_size, uvec4 (1u));
+#endif
 }
-
-		
@@ -1,10 +1,28 @@
-in vec3 vertex;
-varying out vec3 normal;
+#version 330 core
+layout(location = 0) in vec3 vertex;
+layout(location = 1) in vec3 vertex_normal;
+
+// per instance model matrix, occupies locations 2-5
+layout(location = 2) in mat4 model;
+
+// set once per frame
+layout(std140) uniform Camera
+{
+  mat4 projection;
+  mat4 view;
+};
+
+// normals are only needed for the debug outputs
+#ifdef OUTPUT_DEBUG
+out vec3 normal;
+#endif
 
 void main() {
-  gl_Position = gl_ModelViewProjectionMatrix * vec4(vertex, 1.0);
+  mat4 modelview = view * model;
+  gl_Position = projection * modelview * vec4(vertex, 1.0);
 
-  vec3 temp = gl_NormalMatrix * gl_Normal;
+#ifdef OUTPUT_DEBUG
+  vec3 temp = mat3(modelview) * vertex_normal;
   normal = vec3 (-temp.x, temp.y, -temp.z);
+#endif
 }
-
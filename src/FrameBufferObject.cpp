@@ -31,7 +31,9 @@
 // -----------------------------------------------------------------------------
 
 #include "realtime_urdf_filter/FrameBufferObject.h"
+#include <algorithm>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 using namespace std;
@@ -116,7 +118,9 @@ FramebufferObject::FramebufferObject(const char *strMode) :
 
 	_numColorAttachments(1),
 
-	_bFloatColorBuffer(false)
+	_bFloatColorBuffer(false),
+
+	_bPerAttachmentFormats(false)
 {
 	parseModeString(strMode);
 }
@@ -208,6 +212,25 @@ FramebufferObject::getDepthAttachmentID(void) {
 
 // -----------------------------------------------------------------------------
 
+GLuint					
+FramebufferObject::getFramebufferID(void) {
+	return _frameBufferID;
+}
+
+// -----------------------------------------------------------------------------
+
+void
+FramebufferObject::setDepthAttachmentEnabled(bool enabled) {
+	if(!_bDepthAttachment || !_bDepthAttachmentRenderTexture)
+		return;
+	glFramebufferTexture2DEXT(	GL_FRAMEBUFFER_EXT, 
+								GL_DEPTH_ATTACHMENT_EXT, 
+								_textureTarget,
+								enabled ? _depthAttachmentID : 0, 0);
+}
+
+// -----------------------------------------------------------------------------
+
 GLuint					
 FramebufferObject::getStencilAttachmentID(void) {
 	return _depthAttachmentID;
@@ -308,7 +331,12 @@ FramebufferObject::initialize(	unsigned int width, unsigned int height ) {
 		glGenFramebuffersEXT(1, &_frameBufferID);
 		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, _frameBufferID);
 		
-		if(_bColorAttachment) {
+		if(_bColorAttachment && _bPerAttachmentFormats) {
+
+			if(!initializePerAttachmentFormats())
+				printFramebufferStatus();
+
+		} else if(_bColorAttachment) {
 
 			if(_bColorAttachmentRenderTexture) {
 
@@ -725,10 +753,12 @@ FramebufferObject::reInitialize(	unsigned int width, unsigned int height, const
 	glDeleteFramebuffersEXT(1, &_frameBufferID);
 
 	if(_bColorAttachment) {
-		if(_bColorAttachmentRenderTexture) 
-			glDeleteTextures(1, &_colorAttachmentID[0]);
-		else 
-			glDeleteRenderbuffersEXT(1, &_colorAttachmentID[0]);
+		for(int i=0; i<_numColorAttachments; i++) {
+			if(_bColorAttachmentRenderTexture) 
+				glDeleteTextures(1, &_colorAttachmentID[i]);
+			else 
+				glDeleteRenderbuffersEXT(1, &_colorAttachmentID[i]);
+		}
 	}
 
 	if(_bDepthAttachment) {
@@ -799,6 +829,14 @@ FramebufferObject::parseModeString(const char *modeString) {
 
 	_bFloatColorBuffer	= false;
 
+	_bPerAttachmentFormats = false;
+	int numPerAttachment = 0;
+	for (int i = 0; i < MAX_COLOR_COMPONENTS; i++) {
+		_attachmentInternalFormat[i]	= 0;
+		_attachmentFormat[i]			= GL_NONE;
+		_attachmentType[i]				= GL_NONE;
+	}
+
 	char *mode = strdup(modeString);
 
 	vector<string> tokens;
@@ -976,6 +1014,28 @@ FramebufferObject::parseModeString(const char *modeString) {
 
 		}
 
+		// ------------------------------------------------
+		// ------------------------------------------------
+		// handle color attachment with its own format
+
+		else if ( kv.first.size() > 1 && kv.first[0] == 'c' &&
+		          kv.first.find_first_not_of("0123456789", 1) == kv.first.npos) {
+
+			int index = atoi(kv.first.c_str() + 1);
+			if (index >= MAX_COLOR_COMPONENTS || !setAttachmentFormat(index, kv.second)) {
+				cout << "ERROR: FramebufferObject - unsupported color attachment " << token << endl;
+				continue;
+			}
+
+			_bColorAttachment				= true;
+			_bColorAttachmentRenderTexture	= true;
+			_bPerAttachmentFormats			= true;
+			_minFilter						= GL_NEAREST;
+			_magFilter						= GL_NEAREST;
+
+			numPerAttachment = max(numPerAttachment, index + 1);
+		}
+
 		// ------------------------------------------------
 		// ------------------------------------------------
 		// handle depth attachment
@@ -1032,6 +1092,82 @@ FramebufferObject::parseModeString(const char *modeString) {
 		}
 
 	}
+
+	if (_bPerAttachmentFormats)
+		_numColorAttachments = numPerAttachment;
+}
+
+// -----------------------------------------------------------------------------
+
+bool
+FramebufferObject::setAttachmentFormat(int index, const std::string &format) {
+
+	struct Format { const char* name; GLint internalFormat; GLenum format; GLenum type; bool isFloat; };
+	static const Format formats[] = {
+		{ "r8",			GL_R8,			GL_RED,				GL_UNSIGNED_BYTE,	false },
+		{ "r16f",		GL_R16F,		GL_RED,				GL_HALF_FLOAT,		true },
+		{ "r32f",		GL_R32F,		GL_RED,				GL_FLOAT,			true },
+		{ "r8ui",		GL_R8UI,		GL_RED_INTEGER,		GL_UNSIGNED_BYTE,	false },
+		{ "r16ui",		GL_R16UI,		GL_RED_INTEGER,		GL_UNSIGNED_SHORT,	false },
+		{ "r32ui",		GL_R32UI,		GL_RED_INTEGER,		GL_UNSIGNED_INT,	false },
+		{ "rg16f",		GL_RG16F,		GL_RG,				GL_HALF_FLOAT,		true },
+		{ "rg32f",		GL_RG32F,		GL_RG,				GL_FLOAT,			true },
+		{ "rgba8",		GL_RGBA8,		GL_RGBA,			GL_UNSIGNED_BYTE,	false },
+		{ "rgba16f",	GL_RGBA16F,		GL_RGBA,			GL_HALF_FLOAT,		true },
+		{ "rgba32f",	GL_RGBA32F,		GL_RGBA,			GL_FLOAT,			true }
+	};
+
+	for (unsigned int i = 0; i < sizeof(formats) / sizeof(Format); i++) {
+		if (format == formats[i].name) {
+			_attachmentInternalFormat[index]	= formats[i].internalFormat;
+			_attachmentFormat[index]			= formats[i].format;
+			_attachmentType[index]				= formats[i].type;
+			_bFloatColorBuffer					= _bFloatColorBuffer || formats[i].isFloat;
+			return true;
+		}
+	}
+	return false;
+}
+
+// -----------------------------------------------------------------------------
+
+bool
+FramebufferObject::initializePerAttachmentFormats(void) {
+
+	for(int i=0; i<_numColorAttachments; i++) {
+
+		if(_attachmentInternalFormat[i] == 0) {
+			cout << "ERROR: FramebufferObject - color attachment " << i << " has no format, using rgba8" << endl;
+			setAttachmentFormat(i, "rgba8");
+		}
+
+		glGenTextures(1, &_colorAttachmentID[i]);
+		glBindTexture(_textureTarget, _colorAttachmentID[i]);
+
+		glTexParameteri(_textureTarget, GL_TEXTURE_WRAP_S, _wrapS);
+		glTexParameteri(_textureTarget, GL_TEXTURE_WRAP_T, _wrapT);
+		glTexParameteri(_textureTarget, GL_TEXTURE_MIN_FILTER, _minFilter);
+		glTexParameteri(_textureTarget, GL_TEXTURE_MAG_FILTER, _magFilter);
+
+		glTexImage2D(	_textureTarget, 
+						0, 
+						_attachmentInternalFormat[i], 
+						_width, 
+						_height, 
+						0, 
+						_attachmentFormat[i], 
+						_attachmentType[i], 
+						NULL);
+
+		// attachment enums are consecutive
+		glFramebufferTexture2DEXT(	GL_FRAMEBUFFER_EXT, 
+									GL_COLOR_ATTACHMENT0_EXT + i, 
+									_textureTarget,
+									_colorAttachmentID[i], 
+									0);
+	}
+
+	return checkFramebufferStatus();
 }
 
 // -----------------------------------------------------------------------------
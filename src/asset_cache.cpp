@@ -0,0 +1,275 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <realtime_urdf_filter/asset_cache.h>
+#include <realtime_urdf_filter/scene_bundle.h>
+#include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
+#include <ros/console.h>
+
+namespace realtime_urdf_filter
+{
+  AssetCache& AssetCache::instance ()
+  {
+    static AssetCache cache;
+    return cache;
+  }
+
+  boost::shared_ptr<const urdf::Model> AssetCache::getModel (const std::string &description)
+  {
+    size_t hash = boost::hash<std::string> () (description);
+    {
+      boost::mutex::scoped_lock lock (mutex_);
+      std::map<size_t, ModelEntry>::const_iterator it = models_.find (hash);
+      if (it != models_.end () && it->second.description == description)
+      {
+        ++hits_;
+        return it->second.model;
+      }
+      ++misses_;
+    }
+
+    // parse outside of the lock, the same description might be parsed twice
+    // in parallel, which is harmless
+    boost::shared_ptr<urdf::Model> model (new urdf::Model);
+    if (!model->initString (description))
+      return boost::shared_ptr<const urdf::Model> ();
+
+    boost::mutex::scoped_lock lock (mutex_);
+    if (models_.find (hash) == models_.end ())
+    {
+      ModelEntry &entry = models_[hash];
+      entry.description = description;
+      entry.model = model;
+    }
+    return model;
+  }
+
+  boost::shared_ptr<const CompiledModel> AssetCache::getCompiledModel (const std::string &description)
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    if (compiled_models_.empty ())
+      return boost::shared_ptr<const CompiledModel> ();
+
+    std::map<uint64_t, std::pair<size_t, boost::shared_ptr<const CompiledModel> > >::const_iterator it
+      = compiled_models_.find (hashDescription (description));
+    if (it == compiled_models_.end () || it->second.first != description.size ())
+      return boost::shared_ptr<const CompiledModel> ();
+    ++hits_;
+    return it->second.second;
+  }
+
+  // copies one geometry out of a mapped bundle
+  static bool copyBundleGeometry (const SceneBundleFile *bundle, const BundleGeometry *bg, Geometry &geometry)
+  {
+    geometry.shape = (Geometry::Shape) bg->shape;
+    const Geometry::Vertex* vertices = (const Geometry::Vertex*) (bundle->vertices () + bg->first_vertex * 6);
+    geometry.vertices.assign (vertices, vertices + bg->num_vertices);
+    const uint32_t* indices = bundle->indices () + bg->first_index;
+    geometry.indices.assign (indices, indices + bg->num_indices);
+    return true;
+  }
+
+  // transforms in bundles are x y z qx qy qz qw
+  static tf::Transform bundleTransform (const float* t)
+  {
+    return tf::Transform (tf::Quaternion (t[3], t[4], t[5], t[6]), tf::Vector3 (t[0], t[1], t[2]));
+  }
+
+  bool AssetCache::loadBundle (const std::string &file_name)
+  {
+    SceneBundleFile bundle;
+    if (!bundle.open (file_name))
+      return false;
+    const SceneBundleHeader &header = bundle.header ();
+
+    // geometry is copied straight out of the mapping, bundled geometry
+    // replaces nothing that is already cached
+    std::vector<boost::shared_ptr<Geometry> > geometries (header.num_geometries);
+    for (unsigned int g = 0; g < header.num_geometries; ++g)
+    {
+      const BundleGeometry &bg = bundle.geometries ()[g];
+      if ((size_t) bg.first_vertex + bg.num_vertices > header.num_vertices
+          || (size_t) bg.first_index + bg.num_indices > header.num_indices)
+      {
+        ROS_ERROR ("scene bundle %s: geometry %u is out of range", file_name.c_str (), g);
+        return false;
+      }
+
+      geometries[g] = getGeometry (bundle.string (bg.key), boost::bind (&copyBundleGeometry, &bundle, &bg, _1));
+    }
+
+    for (unsigned int m = 0; m < header.num_models; ++m)
+    {
+      const BundleModel &bm = bundle.models ()[m];
+      if ((size_t) bm.first_link + bm.num_links > header.num_links)
+      {
+        ROS_ERROR ("scene bundle %s: model %u is out of range", file_name.c_str (), m);
+        return false;
+      }
+
+      boost::shared_ptr<CompiledModel> model (new CompiledModel);
+      model->name = bundle.string (bm.name);
+      model->links.resize (bm.num_links);
+      for (unsigned int l = 0; l < bm.num_links; ++l)
+      {
+        const BundleLink &bl = bundle.links ()[bm.first_link + l];
+        CompiledLink &link = model->links[l];
+        link.name = bundle.string (bl.name);
+        link.parent = bl.parent;
+        link.joint_name = bundle.string (bl.joint_name);
+        link.joint_type = bl.joint_type;
+        link.joint_origin = bundleTransform (bl.joint_origin);
+        link.joint_axis = tf::Vector3 (bl.joint_axis[0], bl.joint_axis[1], bl.joint_axis[2]);
+        if (bl.geometry >= 0 && (uint32_t) bl.geometry < header.num_geometries)
+          link.geometry = geometries[bl.geometry];
+        link.visual_origin = bundleTransform (bl.visual_origin);
+        link.scale = tf::Vector3 (bl.scale[0], bl.scale[1], bl.scale[2]);
+        link.color.r = bl.color[0];
+        link.color.g = bl.color[1];
+        link.color.b = bl.color[2];
+        link.color.a = bl.color[3];
+      }
+
+      boost::mutex::scoped_lock lock (mutex_);
+      compiled_models_[bm.description_hash] = std::make_pair ((size_t) bm.description_size,
+                                                             boost::shared_ptr<const CompiledModel> (model));
+    }
+
+    ROS_INFO ("loaded scene bundle %s: %u models, %u links, %u geometries",
+        file_name.c_str (), header.num_models, header.num_links, header.num_geometries);
+    return true;
+  }
+
+  boost::shared_ptr<Geometry> AssetCache::getGeometry (const std::string &key,
+                                                       const boost::function<bool (Geometry&)> &init)
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    boost::shared_ptr<Geometry> geometry = geometries_[key];
+    if (geometry)
+    {
+      ++hits_;
+      while (pending_.count (geometry.get ()))
+        created_cond_.wait (lock);
+      return geometry;
+    }
+
+    ++misses_;
+    geometry.reset (new Geometry);
+    geometries_[key] = geometry;
+    pending_.insert (geometry.get ());
+
+    lock.unlock ();
+    bool created = init (*geometry);
+    lock.lock ();
+
+    // a failed geometry is not cached, the waiters get it empty
+    if (!created)
+    {
+      std::map<std::string, boost::shared_ptr<Geometry> >::iterator it = geometries_.find (key);
+      if (it != geometries_.end () && it->second == geometry)
+        geometries_.erase (it);
+    }
+    pending_.erase (geometry.get ());
+    created_cond_.notify_all ();
+    return geometry;
+  }
+
+  bool AssetCache::hasGeometry (const std::string &key)
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    return geometries_.count (key) > 0;
+  }
+
+  boost::shared_ptr<Geometry> AssetCache::findGeometry (const std::string &key)
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    std::map<std::string, boost::shared_ptr<Geometry> >::const_iterator it = geometries_.find (key);
+    if (it == geometries_.end () || pending_.count (it->second.get ()))
+      return boost::shared_ptr<Geometry> ();
+    return it->second;
+  }
+
+  void AssetCache::getGeometries (std::map<std::string, boost::shared_ptr<Geometry> > &geometries)
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    geometries = geometries_;
+  }
+
+  void AssetCache::prune ()
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    for (std::map<size_t, ModelEntry>::iterator it = models_.begin (); it != models_.end (); )
+    {
+      if (it->second.model.unique ())
+        models_.erase (it++);
+      else
+        ++it;
+    }
+    for (std::map<std::string, boost::shared_ptr<Geometry> >::iterator it = geometries_.begin (); it != geometries_.end (); )
+    {
+      if (it->second.unique ())
+        geometries_.erase (it++);
+      else
+        ++it;
+    }
+  }
+
+  unsigned int AssetCache::numModels ()
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    return models_.size ();
+  }
+
+  unsigned int AssetCache::numGeometries ()
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    return geometries_.size ();
+  }
+
+  unsigned int AssetCache::numHits ()
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    return hits_;
+  }
+
+  unsigned int AssetCache::numMisses ()
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    return misses_;
+  }
+
+  unsigned int AssetCache::numCompiledModels ()
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    return compiled_models_.size ();
+  }
+
+} // end namespace
@@ -0,0 +1,344 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <realtime_urdf_filter/context_backend.h>
+
+#include <GL/freeglut.h>
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#ifdef HAVE_OSMESA
+#include <GL/osmesa.h>
+#endif
+
+#include <ros/console.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace realtime_urdf_filter
+{
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief GLUT window, hidden unless the gui is shown. needs an X server. */
+  class GLUTContextBackend : public ContextBackend
+  {
+    public:
+      GLUTContextBackend (bool show_window, int &argc, char **argv)
+        : show_window_ (show_window)
+      {
+        glutInit (&argc, argv);
+
+        // the window will show 3x2 grid of images
+        glutInitWindowSize (960, 480);
+        glutInitDisplayMode ( GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH | GLUT_STENCIL);
+        window_ = glutCreateWindow ("Realtime URDF Filter Debug Window");
+
+        if (!show_window_)
+          glutHideWindow ();
+      }
+
+      virtual ~GLUTContextBackend ()
+      {
+        glutDestroyWindow (window_);
+      }
+
+      virtual bool makeCurrent ()
+      {
+        glutSetWindow (window_);
+        return true;
+      }
+
+      virtual void swapBuffers ()
+      {
+        if (!show_window_)
+          return;
+        glutSwapBuffers ();
+        glutPostRedisplay();
+        glutMainLoopEvent ();
+      }
+
+      virtual bool hasWindow () const {return show_window_;}
+      virtual std::string name () const {return "glut";}
+
+    private:
+      bool show_window_;
+      int window_;
+  };
+
+#ifdef HAVE_EGL
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief EGL context without a window. uses a surfaceless context if the
+    * driver supports it and a small pbuffer surface otherwise. */
+  class EGLContextBackend : public ContextBackend
+  {
+    public:
+      EGLContextBackend ()
+        : display_ (EGL_NO_DISPLAY)
+        , surface_ (EGL_NO_SURFACE)
+        , context_ (EGL_NO_CONTEXT)
+      {}
+
+      virtual ~EGLContextBackend ()
+      {
+        if (display_ == EGL_NO_DISPLAY)
+          return;
+        eglMakeCurrent (display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (context_ != EGL_NO_CONTEXT)
+          eglDestroyContext (display_, context_);
+        if (surface_ != EGL_NO_SURFACE)
+          eglDestroySurface (display_, surface_);
+        eglTerminate (display_);
+      }
+
+      bool init ()
+      {
+        display_ = getDisplay ();
+        EGLint major, minor;
+        if (display_ == EGL_NO_DISPLAY || !eglInitialize (display_, &major, &minor))
+        {
+          ROS_ERROR ("EGL: could not initialize display");
+          return false;
+        }
+        ROS_INFO ("EGL: version %i.%i, vendor %s", major, minor, eglQueryString (display_, EGL_VENDOR));
+
+        const EGLint config_attribs[] = {
+          EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+          EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+          EGL_DEPTH_SIZE, 24, EGL_STENCIL_SIZE, 8,
+          EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+          EGL_NONE
+        };
+        EGLConfig config;
+        EGLint num_configs = 0;
+        if (!eglChooseConfig (display_, config_attribs, &config, 1, &num_configs) || num_configs == 0)
+        {
+          ROS_ERROR ("EGL: no suitable config found");
+          return false;
+        }
+
+        if (!eglBindAPI (EGL_OPENGL_API))
+        {
+          ROS_ERROR ("EGL: desktop OpenGL is not supported");
+          return false;
+        }
+
+        context_ = EGL_NO_CONTEXT;
+#ifdef EGL_CONTEXT_OPENGL_PROFILE_MASK
+        // the shaders are GLSL 3.30. FramebufferObject still uses the EXT
+        // entry points, so ask for a compatibility profile rather than core
+        const EGLint context_attribs[] = {
+          EGL_CONTEXT_MAJOR_VERSION, 3,
+          EGL_CONTEXT_MINOR_VERSION, 3,
+          EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+          EGL_NONE
+        };
+        context_ = eglCreateContext (display_, config, EGL_NO_CONTEXT, context_attribs);
+#endif
+        // EGL before 1.5, or no 3.3 compatibility profile: take the default
+        // context, initGL checks its version
+        if (context_ == EGL_NO_CONTEXT)
+          context_ = eglCreateContext (display_, config, EGL_NO_CONTEXT, NULL);
+        if (context_ == EGL_NO_CONTEXT)
+        {
+          ROS_ERROR ("EGL: could not create context");
+          return false;
+        }
+
+        // we render into our own FBO, so we only need a surface if the
+        // driver can not make a context current without one
+        const char* extensions = eglQueryString (display_, EGL_EXTENSIONS);
+        if (!extensions || !strstr (extensions, "EGL_KHR_surfaceless_context"))
+        {
+          const EGLint pbuffer_attribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+          surface_ = eglCreatePbufferSurface (display_, config, pbuffer_attribs);
+          if (surface_ == EGL_NO_SURFACE)
+          {
+            ROS_ERROR ("EGL: could not create pbuffer surface");
+            return false;
+          }
+        }
+        return makeCurrent ();
+      }
+
+      virtual bool makeCurrent ()
+      {
+        return eglMakeCurrent (display_, surface_, surface_, context_) == EGL_TRUE;
+      }
+
+      virtual std::string name () const {return "egl";}
+
+    private:
+      // prefer the first GPU device, so no X server or GBM device node is needed
+      EGLDisplay getDisplay ()
+      {
+#if defined(EGL_EXT_device_base) && defined(EGL_EXT_platform_device)
+        PFNEGLQUERYDEVICESEXTPROC queryDevices =
+          (PFNEGLQUERYDEVICESEXTPROC) eglGetProcAddress ("eglQueryDevicesEXT");
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+          (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress ("eglGetPlatformDisplayEXT");
+        if (queryDevices && getPlatformDisplay)
+        {
+          EGLDeviceEXT devices[4];
+          EGLint num_devices = 0;
+          if (queryDevices (4, devices, &num_devices) && num_devices > 0)
+          {
+            EGLDisplay display = getPlatformDisplay (EGL_PLATFORM_DEVICE_EXT, devices[0], NULL);
+            if (display != EGL_NO_DISPLAY)
+              return display;
+          }
+        }
+#endif
+        return eglGetDisplay (EGL_DEFAULT_DISPLAY);
+      }
+
+      EGLDisplay display_;
+      EGLSurface surface_;
+      EGLContext context_;
+  };
+#endif
+
+#ifdef HAVE_OSMESA
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief Mesa software context (llvmpipe), rendering into host memory */
+  class OSMesaContextBackend : public ContextBackend
+  {
+    public:
+      OSMesaContextBackend (int width, int height)
+        : context_ (0)
+        , buffer_ (0)
+        , width_ (width)
+        , height_ (height)
+      {}
+
+      virtual ~OSMesaContextBackend ()
+      {
+        if (context_)
+          OSMesaDestroyContext (context_);
+        free (buffer_);
+      }
+
+      bool init ()
+      {
+#ifdef OSMESA_CONTEXT_MAJOR_VERSION
+        // the shaders are GLSL 3.30. FramebufferObject still uses the EXT
+        // entry points, so ask for a compatibility profile rather than core
+        const int attribs[] = {
+          OSMESA_FORMAT, OSMESA_RGBA,
+          OSMESA_DEPTH_BITS, 24,
+          OSMESA_STENCIL_BITS, 8,
+          OSMESA_PROFILE, OSMESA_COMPAT_PROFILE,
+          OSMESA_CONTEXT_MAJOR_VERSION, 3,
+          OSMESA_CONTEXT_MINOR_VERSION, 3,
+          0
+        };
+        context_ = OSMesaCreateContextAttribs (attribs, NULL);
+#endif
+        // older Mesa, or no 3.3 compatibility profile: take what we get and
+        // check the version below
+        if (!context_)
+          context_ = OSMesaCreateContextExt (OSMESA_RGBA, 24, 8, 0, NULL);
+        if (!context_)
+        {
+          ROS_ERROR ("OSMesa: could not create context");
+          return false;
+        }
+        buffer_ = malloc (width_ * height_ * 4 * sizeof(GLubyte));
+        if (!makeCurrent ())
+          return false;
+
+        int major = 0, minor = 0;
+        const char* version = (const char*) glGetString (GL_VERSION);
+        if (!version || sscanf (version, "%d.%d", &major, &minor) != 2 || major * 10 + minor < 33)
+        {
+          ROS_ERROR ("OSMesa: context has OpenGL %s, at least 3.3 is needed", version ? version : "(unknown)");
+          return false;
+        }
+        return true;
+      }
+
+      virtual bool makeCurrent ()
+      {
+        return OSMesaMakeCurrent (context_, buffer_, GL_UNSIGNED_BYTE, width_, height_) == GL_TRUE;
+      }
+
+      virtual std::string name () const {return "osmesa";}
+
+    private:
+      OSMesaContext context_;
+      void* buffer_;
+      int width_;
+      int height_;
+  };
+#endif
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief named constructor, creates the backend and makes it current */
+  ContextBackend* ContextBackend::create (const std::string &backend,
+                                          int width, int height, bool show_window,
+                                          int &argc, char **argv)
+  {
+    if (show_window && backend != "glut")
+      ROS_WARN ("context backend '%s' has no window, the gui will not be shown", backend.c_str ());
+
+    if (backend == "glut")
+    {
+      return new GLUTContextBackend (show_window, argc, argv);
+    }
+    else if (backend == "egl")
+    {
+#ifdef HAVE_EGL
+      EGLContextBackend* context = new EGLContextBackend ();
+      if (context->init ())
+        return context;
+      delete context;
+#else
+      ROS_ERROR ("realtime_urdf_filter was built without EGL support");
+#endif
+    }
+    else if (backend == "osmesa")
+    {
+#ifdef HAVE_OSMESA
+      OSMesaContextBackend* context = new OSMesaContextBackend (width, height);
+      if (context->init ())
+        return context;
+      delete context;
+#else
+      ROS_ERROR ("realtime_urdf_filter was built without OSMesa support");
+#endif
+    }
+    else
+    {
+      ROS_ERROR ("unknown context backend '%s'", backend.c_str ());
+    }
+    return NULL;
+  }
+
+} // end namespace
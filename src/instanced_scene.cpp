@@ -0,0 +1,356 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <realtime_urdf_filter/instanced_scene.h>
+#include <map>
+
+namespace realtime_urdf_filter
+{
+  InstancedScene::InstancedScene ()
+    : num_mesh_batches_ (0)
+    , impostors_ (true)
+    , num_impostors_ (0)
+    , num_instances_ (0)
+    , num_draw_calls_ (0)
+    , num_culled_ (0)
+    , uploaded_ (false)
+    , vao_ (0)
+    , vertex_vbo_ (0)
+    , index_vbo_ (0)
+    , instance_vbo_ (0)
+    , indirect_buffer_ (0)
+  {}
+
+  InstancedScene::~InstancedScene ()
+  {
+    if (vao_ != 0)
+    {
+      glDeleteVertexArrays (1, &vao_);
+      glDeleteBuffers (1, &vertex_vbo_);
+      glDeleteBuffers (1, &index_vbo_);
+      glDeleteBuffers (1, &instance_vbo_);
+      glDeleteBuffers (1, &indirect_buffer_);
+    }
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief groups the renderables of all renderers by their shared geometry,
+   * and packs all geometry into one vertex and one index array */
+  void InstancedScene::build (const std::vector<URDFRenderer*> &renderers)
+  {
+    batches_.clear ();
+    num_instances_ = 0;
+
+    std::map<Geometry*, unsigned int> batch_index;
+    for (unsigned int r = 0; r < renderers.size (); ++r)
+    {
+      const std::vector<boost::shared_ptr<Renderable> > &renderables = renderers[r]->getRenderables ();
+      for (unsigned int i = 0; i < renderables.size (); ++i)
+      {
+        const boost::shared_ptr<Geometry> &geometry = renderables[i]->geometry;
+        if (geometry->indices.empty ())
+          continue;
+
+        std::map<Geometry*, unsigned int>::iterator it = batch_index.find (geometry.get ());
+        if (it == batch_index.end ())
+        {
+          it = batch_index.insert (std::make_pair (geometry.get (), batches_.size ())).first;
+          batches_.push_back (Batch ());
+          batches_.back ().geometry = geometry;
+        }
+        batches_[it->second].instances.push_back (renderables[i].get ());
+        ++num_instances_;
+
+        // compute the bounding sphere now, not in the first frame
+        tf::Vector3 center;
+        double radius;
+        geometry->getBoundingSphere (center, radius);
+      }
+    }
+
+    // impostor batches go last, so the meshes are one contiguous range of
+    // draw commands
+    num_mesh_batches_ = batches_.size ();
+    num_impostors_ = 0;
+    if (impostors_)
+    {
+      std::vector<Batch> impostor_batches;
+      for (unsigned int b = 0; b < batches_.size (); )
+      {
+        if (isImpostor (*batches_[b].geometry))
+        {
+          num_impostors_ += batches_[b].instances.size ();
+          impostor_batches.push_back (batches_[b]);
+          batches_.erase (batches_.begin () + b);
+        }
+        else
+          ++b;
+      }
+      num_mesh_batches_ = batches_.size ();
+      batches_.insert (batches_.end (), impostor_batches.begin (), impostor_batches.end ());
+    }
+
+    // one draw command per batch, indices stay relative to their geometry
+    vertices_.clear ();
+    indices_.clear ();
+    commands_.resize (batches_.size ());
+    unsigned int base_instance = 0;
+    for (unsigned int b = 0; b < batches_.size (); ++b)
+    {
+      const Geometry &geometry = *batches_[b].geometry;
+      DrawCommand &command = commands_[b];
+      command.instance_count = batches_[b].instances.size ();
+      command.base_instance = base_instance;
+      base_instance += command.instance_count;
+
+      // all impostors share the proxy box, which is packed after the meshes
+      if (b >= num_mesh_batches_)
+        continue;
+      command.count = geometry.indices.size ();
+      command.first_index = indices_.size ();
+      command.base_vertex = vertices_.size ();
+      vertices_.insert (vertices_.end (), geometry.vertices.begin (), geometry.vertices.end ());
+      indices_.insert (indices_.end (), geometry.indices.begin (), geometry.indices.end ());
+    }
+
+    if (num_mesh_batches_ < batches_.size ())
+    {
+      unsigned int first_index = indices_.size ();
+      unsigned int base_vertex = vertices_.size ();
+      for (int i = 0; i < 8; ++i)
+        vertices_.push_back (Geometry::Vertex ((i & 1) ? 1 : -1, (i & 2) ? 1 : -1, (i & 4) ? 1 : -1, 0, 0, 0));
+      const unsigned int box[36] = {0, 2, 1,  1, 2, 3,  4, 5, 6,  5, 7, 6,
+                                    0, 1, 4,  1, 5, 4,  2, 6, 3,  3, 6, 7,
+                                    0, 4, 2,  2, 4, 6,  1, 3, 5,  3, 7, 5};
+      indices_.insert (indices_.end (), box, box + 36);
+      for (unsigned int b = num_mesh_batches_; b < batches_.size (); ++b)
+      {
+        commands_[b].count = 36;
+        commands_[b].first_index = first_index;
+        commands_[b].base_vertex = base_vertex;
+      }
+    }
+
+    matrices_.resize (num_instances_ * 16);
+    uploaded_ = false;
+    ROS_INFO ("instanced scene: %u renderables in %u batches (%u impostors), %u vertices, %u indices",
+        num_instances_, (unsigned int) batches_.size (), num_impostors_,
+        (unsigned int) vertices_.size (), (unsigned int) indices_.size ());
+  }
+
+  bool InstancedScene::isImpostor (const Geometry &geometry)
+  {
+    return geometry.shape == Geometry::SPHERE || geometry.shape == Geometry::CYLINDER;
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief creates the VAO with arena and instance buffers, and the indirect buffer */
+  void InstancedScene::upload ()
+  {
+    if (vao_ == 0)
+    {
+      glGenVertexArrays (1, &vao_);
+      glGenBuffers (1, &vertex_vbo_);
+      glGenBuffers (1, &index_vbo_);
+      glGenBuffers (1, &instance_vbo_);
+      glGenBuffers (1, &indirect_buffer_);
+    }
+
+    glBindVertexArray (vao_);
+
+    // attribute 0 is the position, attribute 1 the normal
+    glBindBuffer (GL_ARRAY_BUFFER, vertex_vbo_);
+    glBufferData (GL_ARRAY_BUFFER, sizeof(Geometry::Vertex) * vertices_.size (), &vertices_[0], GL_STATIC_DRAW);
+    glEnableVertexAttribArray (0);
+    glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, sizeof (Geometry::Vertex), 0);
+    glEnableVertexAttribArray (1);
+    glVertexAttribPointer (1, 3, GL_FLOAT, GL_FALSE, sizeof (Geometry::Vertex), (const GLvoid*) (sizeof(float)*3));
+
+    // attributes 2-5 are the columns of the per-instance model matrix
+    glBindBuffer (GL_ARRAY_BUFFER, instance_vbo_);
+    glBufferData (GL_ARRAY_BUFFER, matrices_.size () * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
+    for (int c = 0; c < 4; ++c)
+    {
+      glEnableVertexAttribArray (2 + c);
+      glVertexAttribDivisor (2 + c, 1);
+    }
+    setInstanceOffset (0);
+
+    // the element buffer binding is part of the VAO state
+    glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, index_vbo_);
+    glBufferData (GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices_.size (), &indices_[0], GL_STATIC_DRAW);
+
+    glBindVertexArray (0);
+    glBindBuffer (GL_ARRAY_BUFFER, 0);
+
+#ifdef GL_ARB_multi_draw_indirect
+    if (GLEW_ARB_multi_draw_indirect)
+    {
+      glBindBuffer (GL_DRAW_INDIRECT_BUFFER, indirect_buffer_);
+      glBufferData (GL_DRAW_INDIRECT_BUFFER, sizeof(DrawCommand) * commands_.size (), &commands_[0], GL_DYNAMIC_DRAW);
+      glBindBuffer (GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+#endif
+
+    uploaded_ = true;
+  }
+
+  void InstancedScene::setInstanceOffset (unsigned int instance)
+  {
+    // needs the VAO and the instance buffer bound
+    for (int c = 0; c < 4; ++c)
+      glVertexAttribPointer (2 + c, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(GLfloat),
+                             (const GLvoid*) ((instance * 16 + c * 4) * sizeof(GLfloat)));
+  }
+
+  void InstancedScene::drawCommands (unsigned int begin, unsigned int end)
+  {
+#ifdef GL_ARB_base_instance
+    // one call per command, still without touching any vertex state
+    if (GLEW_ARB_base_instance)
+    {
+      for (unsigned int b = begin; b < end; ++b)
+      {
+        const DrawCommand &command = commands_[b];
+        if (command.instance_count == 0)
+          continue;
+        glDrawElementsInstancedBaseVertexBaseInstance (GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+            (const GLvoid*) (command.first_index * sizeof(unsigned int)),
+            command.instance_count, command.base_vertex, command.base_instance);
+        ++num_draw_calls_;
+      }
+      return;
+    }
+#endif
+
+    // plain GL 3.3: emulate baseInstance by moving the instance attributes
+    glBindBuffer (GL_ARRAY_BUFFER, instance_vbo_);
+    for (unsigned int b = begin; b < end; ++b)
+    {
+      const DrawCommand &command = commands_[b];
+      if (command.instance_count == 0)
+        continue;
+      setInstanceOffset (command.base_instance);
+      glDrawElementsInstancedBaseVertex (GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+          (const GLvoid*) (command.first_index * sizeof(unsigned int)),
+          command.instance_count, command.base_vertex);
+      ++num_draw_calls_;
+    }
+    setInstanceOffset (0);
+    glBindBuffer (GL_ARRAY_BUFFER, 0);
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief culls the instances of a layer, streams the model matrices of the visible
+   * ones into the instance buffer and draws them */
+  void InstancedScene::render (const Frustum &frustum, Layer layer)
+  {
+    num_draw_calls_ = 0;
+    num_culled_ = 0;
+    if (num_instances_ == 0)
+      return;
+
+    if (!uploaded_)
+      upload ();
+
+    // collect the model matrices of all visible instances, and shrink the
+    // draw commands accordingly
+    unsigned int n = 0;
+    for (unsigned int b = 0; b < batches_.size (); ++b)
+    {
+      DrawCommand &command = commands_[b];
+      command.base_instance = n;
+      command.instance_count = 0;
+      for (unsigned int i = 0; i < batches_[b].instances.size (); ++i)
+      {
+        const Renderable &renderable = *batches_[b].instances[i];
+        if ((layer == STATIC_LAYER && !renderable.is_static) ||
+            (layer == DYNAMIC_LAYER && renderable.is_static))
+          continue;
+        tf::Vector3 center;
+        double radius;
+        renderable.getBoundingSphere (center, radius);
+        if (!frustum.intersectsSphere (center, radius))
+        {
+          ++num_culled_;
+          continue;
+        }
+        renderable.getModelMatrix (&matrices_[n * 16]);
+        ++command.instance_count;
+        ++n;
+      }
+    }
+    if (n == 0)
+      return;
+
+    // orphan last frame's matrices, they might still be in use
+    glBindBuffer (GL_ARRAY_BUFFER, instance_vbo_);
+    glBufferData (GL_ARRAY_BUFFER, matrices_.size () * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
+    glBufferSubData (GL_ARRAY_BUFFER, 0, n * 16 * sizeof(GLfloat), &matrices_[0]);
+
+    glBindVertexArray (vao_);
+
+#ifdef GL_ARB_multi_draw_indirect
+    // all meshes in one call
+    if (GLEW_ARB_multi_draw_indirect)
+    {
+      if (num_mesh_batches_ > 0)
+      {
+        glBindBuffer (GL_DRAW_INDIRECT_BUFFER, indirect_buffer_);
+        glBufferSubData (GL_DRAW_INDIRECT_BUFFER, 0, sizeof(DrawCommand) * num_mesh_batches_, &commands_[0]);
+        glMultiDrawElementsIndirect (GL_TRIANGLES, GL_UNSIGNED_INT, 0, num_mesh_batches_, 0);
+        glBindBuffer (GL_DRAW_INDIRECT_BUFFER, 0);
+        num_draw_calls_ = 1;
+      }
+    }
+    else
+#endif
+      drawCommands (0, num_mesh_batches_);
+
+    glBindVertexArray (0);
+    glBindBuffer (GL_ARRAY_BUFFER, 0);
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief draws the proxy boxes of all visible instances of one shape, with
+   * the model matrices uploaded by the last render () */
+  void InstancedScene::renderImpostors (Geometry::Shape shape)
+  {
+    if (!uploaded_)
+      return;
+
+    glBindVertexArray (vao_);
+    for (unsigned int b = num_mesh_batches_; b < batches_.size (); ++b)
+      if (batches_[b].geometry->shape == shape)
+        drawCommands (b, b + 1);
+    glBindVertexArray (0);
+  }
+
+} // end namespace
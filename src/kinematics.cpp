@@ -0,0 +1,235 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <realtime_urdf_filter/kinematics.h>
+#include <realtime_urdf_filter/asset_cache.h>
+
+namespace realtime_urdf_filter
+{
+  Kinematics::Kinematics ()
+    : has_joint_state_ (false)
+    , num_missing_ (0)
+  {}
+
+  static tf::Transform toTransform (const urdf::Pose &pose)
+  {
+    return tf::Transform (
+        tf::Quaternion (pose.rotation.x, pose.rotation.y, pose.rotation.z, pose.rotation.w).normalize (),
+        tf::Vector3 (pose.position.x, pose.position.y, pose.position.z));
+  }
+
+  void Kinematics::init (const urdf::Model &model)
+  {
+    // depth first from the root, so parents come before their children
+    boost::shared_ptr<const urdf::Link> root = model.getRoot ();
+    if (!root)
+      return;
+    root_link_ = root->name;
+    addSubtree (*root, -1);
+    resolveMimicJoints ();
+  }
+
+  void Kinematics::addSubtree (const urdf::Link &link, int parent)
+  {
+    if (parent < 0)
+      addLink (link.name, -1, "", urdf::Joint::FIXED, tf::Transform::getIdentity (), tf::Vector3 (0, 0, 0));
+    else
+    {
+      const urdf::Joint &joint = *link.parent_joint;
+      addLink (link.name, parent, joint.name, joint.type, toTransform (joint.parent_to_joint_origin_transform),
+               tf::Vector3 (joint.axis.x, joint.axis.y, joint.axis.z));
+
+      int position = position_indices_.back ();
+      if (position >= 0 && joint.mimic)
+      {
+        mimic_joint_names_[position] = joint.mimic->joint_name;
+        mimic_multipliers_[position] = joint.mimic->multiplier;
+        mimic_offsets_[position] = joint.mimic->offset;
+      }
+    }
+
+    int index = parents_.size () - 1;
+    for (unsigned int c = 0; c < link.child_links.size (); ++c)
+      addSubtree (*link.child_links[c], index);
+  }
+
+  void Kinematics::resolveMimicJoints ()
+  {
+    std::map<int, std::string>::const_iterator it = mimic_joint_names_.begin ();
+    for (; it != mimic_joint_names_.end (); ++it)
+    {
+      std::map<std::string, int>::const_iterator source = joint_indices_.find (it->second);
+      if (source != joint_indices_.end () && source->second != it->first)
+        mimic_sources_[it->first] = source->second;
+    }
+    mimic_joint_names_.clear ();
+
+    // p = m1 * s + o1 and s = m2 * t + o2 give p = m1 * m2 * t + m1 * o2 + o1.
+    // a cycle never reaches a free joint, its joints are left free instead
+    for (unsigned int p = 0; p < mimic_sources_.size (); ++p)
+    {
+      unsigned int steps = 0;
+      while (mimic_sources_[p] >= 0 && mimic_sources_[mimic_sources_[p]] >= 0 && steps++ < mimic_sources_.size ())
+      {
+        int s = mimic_sources_[p];
+        mimic_offsets_[p] += mimic_multipliers_[p] * mimic_offsets_[s];
+        mimic_multipliers_[p] *= mimic_multipliers_[s];
+        mimic_sources_[p] = mimic_sources_[s];
+      }
+      if (mimic_sources_[p] >= 0 && mimic_sources_[mimic_sources_[p]] >= 0)
+        mimic_sources_[p] = -1;
+    }
+
+    num_missing_ = 0;
+    for (unsigned int p = 0; p < mimic_sources_.size (); ++p)
+      if (mimic_sources_[p] < 0)
+        ++num_missing_;
+  }
+
+  void Kinematics::init (const CompiledModel &model)
+  {
+    // bundled links are in no particular order: add every link whose parent
+    // is known until all are added
+    std::vector<int> added (model.links.size (), -1);
+    bool progress = true;
+    while (progress)
+    {
+      progress = false;
+      for (unsigned int i = 0; i < model.links.size (); ++i)
+      {
+        const CompiledLink &link = model.links[i];
+        if (added[i] >= 0)
+          continue;
+        if (link.parent >= 0 && ((unsigned int) link.parent >= added.size () || added[link.parent] < 0))
+          continue;
+
+        int parent = link.parent >= 0 ? added[link.parent] : -1;
+        if (parent < 0)
+        {
+          root_link_ = link.name;
+          addLink (link.name, -1, "", urdf::Joint::FIXED, tf::Transform::getIdentity (), tf::Vector3 (0, 0, 0));
+        }
+        else
+          addLink (link.name, parent, link.joint_name, link.joint_type, link.joint_origin, link.joint_axis);
+        added[i] = parents_.size () - 1;
+        progress = true;
+      }
+    }
+
+    // bundles do not record mimic joints, so these are expected in the
+    // JointState like all others
+    resolveMimicJoints ();
+  }
+
+  void Kinematics::addLink (const std::string &name, int parent, const std::string &joint_name,
+                            int joint_type, const tf::Transform &origin, const tf::Vector3 &axis)
+  {
+    link_indices_[name] = parents_.size ();
+    parents_.push_back (parent);
+    joint_types_.push_back (joint_type);
+    origins_.push_back (origin);
+    axes_.push_back (axis.length2 () > 0.0 ? axis.normalized () : tf::Vector3 (1, 0, 0));
+
+    int position = -1;
+    if (joint_type == urdf::Joint::REVOLUTE || joint_type == urdf::Joint::CONTINUOUS
+        || joint_type == urdf::Joint::PRISMATIC)
+    {
+      position = positions_.size ();
+      joint_indices_[joint_name] = position;
+      positions_.push_back (0.0);
+      received_.push_back (false);
+      mimic_sources_.push_back (-1);
+      mimic_multipliers_.push_back (1.0);
+      mimic_offsets_.push_back (0.0);
+    }
+    position_indices_.push_back (position);
+  }
+
+  int Kinematics::linkIndex (const std::string &link) const
+  {
+    std::map<std::string, int>::const_iterator it = link_indices_.find (link);
+    return it == link_indices_.end () ? -1 : it->second;
+  }
+
+  void Kinematics::setJointState (const sensor_msgs::JointState &state)
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    for (unsigned int i = 0; i < state.name.size () && i < state.position.size (); ++i)
+    {
+      std::map<std::string, int>::const_iterator it = joint_indices_.find (state.name[i]);
+      if (it == joint_indices_.end () || mimic_sources_[it->second] >= 0)
+        continue;
+      positions_[it->second] = state.position[i];
+      if (!received_[it->second])
+      {
+        received_[it->second] = true;
+        --num_missing_;
+      }
+    }
+    has_joint_state_ = true;
+  }
+
+  bool Kinematics::hasJointState ()
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    return has_joint_state_ && num_missing_ == 0;
+  }
+
+  void Kinematics::computeLinkPoses (const tf::Transform &root_to_fixed, std::vector<tf::Transform> &poses)
+  {
+    {
+      boost::mutex::scoped_lock lock (mutex_);
+      current_ = positions_;
+    }
+    for (unsigned int p = 0; p < current_.size (); ++p)
+      if (mimic_sources_[p] >= 0)
+        current_[p] = mimic_multipliers_[p] * current_[mimic_sources_[p]] + mimic_offsets_[p];
+
+    poses.resize (parents_.size ());
+    for (unsigned int i = 0; i < parents_.size (); ++i)
+    {
+      if (parents_[i] < 0)
+      {
+        poses[i] = root_to_fixed;
+        continue;
+      }
+
+      poses[i] = poses[parents_[i]] * origins_[i];
+      int p = position_indices_[i];
+      if (p < 0)
+        continue;
+      if (joint_types_[i] == urdf::Joint::PRISMATIC)
+        poses[i] *= tf::Transform (tf::Quaternion::getIdentity (), axes_[i] * current_[p]);
+      else
+        poses[i] *= tf::Transform (tf::Quaternion (axes_[i], current_[p]));
+    }
+  }
+
+} // end namespace
@@ -0,0 +1,182 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <realtime_urdf_filter/latency_metrics.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace realtime_urdf_filter
+{
+  LatencyMetrics::LatencyMetrics (size_t window_size)
+    : window_size_ (window_size)
+  {}
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief add a sample (in seconds) to the rolling window of a stage */
+  void LatencyMetrics::addSample (const std::string &stage, double seconds)
+  {
+    std::map<std::string, Window>::iterator it = stages_.find (stage);
+    if (it == stages_.end ())
+    {
+      it = stages_.insert (std::make_pair (stage, Window ())).first;
+      it->second.samples.reserve (window_size_);
+      stage_names_.push_back (stage);
+    }
+
+    Window &w = it->second;
+    if (w.samples.size () < window_size_)
+      w.samples.push_back (seconds);
+    else
+      w.samples[w.next] = seconds;
+    w.next = (w.next + 1) % window_size_;
+  }
+
+  void LatencyMetrics::setCounter (const std::string &name, double value)
+  {
+    if (counters_.find (name) == counters_.end ())
+      counter_names_.push_back (name);
+    counters_[name] = value;
+  }
+
+  void LatencyMetrics::incrementCounter (const std::string &name, double value)
+  {
+    if (counters_.find (name) == counters_.end ())
+      counter_names_.push_back (name);
+    counters_[name] += value;
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief percentiles over the current window of a stage */
+  LatencyMetrics::Stats LatencyMetrics::getStats (const std::string &stage) const
+  {
+    Stats stats;
+    std::map<std::string, Window>::const_iterator it = stages_.find (stage);
+    if (it == stages_.end () || it->second.samples.empty ())
+      return stats;
+
+    std::vector<double> sorted (it->second.samples);
+    std::sort (sorted.begin (), sorted.end ());
+
+    stats.count = sorted.size ();
+    double sum = 0;
+    for (size_t i = 0; i < sorted.size (); ++i)
+      sum += sorted[i];
+    stats.mean = sum / sorted.size ();
+
+    // nearest-rank percentiles
+    size_t last = sorted.size () - 1;
+    stats.p50 = sorted[(size_t)(0.50 * last + 0.5)];
+    stats.p95 = sorted[(size_t)(0.95 * last + 0.5)];
+    stats.p99 = sorted[(size_t)(0.99 * last + 0.5)];
+    stats.max = sorted[last];
+    return stats;
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief write all stages (in milliseconds) and counters into a diagnostic status */
+  void LatencyMetrics::toDiagnostics (diagnostic_msgs::DiagnosticStatus &status) const
+  {
+    for (size_t i = 0; i < stage_names_.size (); ++i)
+    {
+      Stats s = getStats (stage_names_[i]);
+      const char* suffixes[] = {" p50 [ms]", " p95 [ms]", " p99 [ms]"};
+      double values[] = {s.p50, s.p95, s.p99};
+      for (int j = 0; j < 3; ++j)
+      {
+        diagnostic_msgs::KeyValue kv;
+        kv.key = stage_names_[i] + suffixes[j];
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision (3) << values[j] * 1000.0;
+        kv.value = ss.str ();
+        status.values.push_back (kv);
+      }
+    }
+
+    for (size_t i = 0; i < counter_names_.size (); ++i)
+    {
+      diagnostic_msgs::KeyValue kv;
+      kv.key = counter_names_[i];
+      std::ostringstream ss;
+      ss << counters_.find (counter_names_[i])->second;
+      kv.value = ss.str ();
+      status.values.push_back (kv);
+    }
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief human readable summary, one line per stage */
+  void LatencyMetrics::print (std::ostream &os) const
+  {
+    os << std::left << std::setw (16) << "stage" << std::right
+       << std::setw (8) << "n"
+       << std::setw (10) << "mean"
+       << std::setw (10) << "p50"
+       << std::setw (10) << "p95"
+       << std::setw (10) << "p99"
+       << std::setw (10) << "max" << "   [ms]" << std::endl;
+
+    os << std::fixed << std::setprecision (3);
+    for (size_t i = 0; i < stage_names_.size (); ++i)
+    {
+      Stats s = getStats (stage_names_[i]);
+      os << std::left << std::setw (16) << stage_names_[i] << std::right
+         << std::setw (8) << s.count
+         << std::setw (10) << s.mean * 1000.0
+         << std::setw (10) << s.p50 * 1000.0
+         << std::setw (10) << s.p95 * 1000.0
+         << std::setw (10) << s.p99 * 1000.0
+         << std::setw (10) << s.max * 1000.0 << std::endl;
+    }
+
+    for (size_t i = 0; i < counter_names_.size (); ++i)
+      os << std::left << std::setw (16) << counter_names_[i] << std::right
+         << std::setw (8) << counters_.find (counter_names_[i])->second << std::endl;
+  }
+
+  void LatencyMetrics::clear ()
+  {
+    stages_.clear ();
+    stage_names_.clear ();
+    counters_.clear ();
+    counter_names_.clear ();
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief forget the samples of all stages, but keep the counters */
+  void LatencyMetrics::clearSamples (size_t window_size)
+  {
+    window_size_ = window_size;
+    stages_.clear ();
+    stage_names_.clear ();
+  }
+
+} // end namespace
@@ -28,136 +28,263 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-#define GL3_PROTOTYPES 1
-#include <GL3/gl3.h>
-#include <GL/freeglut.h>
 #include <realtime_urdf_filter/renderable.h>
+#include <realtime_urdf_filter/asset_cache.h>
 #include <resource_retriever/retriever.h>
 #include <assimp/assimp.hpp>
 #include <assimp/aiScene.h>
 #include <assimp/aiPostProcess.h>
 #include <assimp/IOStream.h>
 #include <assimp/IOSystem.h>
+#include <boost/bind.hpp>
+#include <algorithm>
 
 namespace realtime_urdf_filter
 {
+  // geometry methods
+  const std::vector<float>& Geometry::getTriangles ()
+  {
+    if (triangles.empty ())
+    {
+      triangles.reserve (indices.size () * 3);
+      for (unsigned int i = 0; i < indices.size (); ++i)
+      {
+        const Vertex &v = vertices[indices[i]];
+        triangles.push_back (v.x);
+        triangles.push_back (v.y);
+        triangles.push_back (v.z);
+      }
+    }
+    return triangles;
+  }
+
+  void Geometry::getBoundingSphere (tf::Vector3 &center, double &radius)
+  {
+    if (bounds_radius < 0.0)
+    {
+      // sphere around the axis aligned bounding box
+      tf::Vector3 min_pt, max_pt;
+      getBoundingBox (min_pt, max_pt);
+      bounds_center = (min_pt + max_pt) * 0.5;
+      bounds_radius = 0.0;
+      for (unsigned int i = 0; i < vertices.size (); ++i)
+      {
+        tf::Vector3 p (vertices[i].x, vertices[i].y, vertices[i].z);
+        bounds_radius = std::max (bounds_radius, (double) (p - bounds_center).length ());
+      }
+    }
+    center = bounds_center;
+    radius = bounds_radius;
+  }
+
+  void Geometry::getBoundingBox (tf::Vector3 &min_pt, tf::Vector3 &max_pt) const
+  {
+    min_pt = max_pt = tf::Vector3 (0, 0, 0);
+    for (unsigned int i = 0; i < vertices.size (); ++i)
+    {
+      tf::Vector3 p (vertices[i].x, vertices[i].y, vertices[i].z);
+      if (i == 0)
+        min_pt = max_pt = p;
+      min_pt.setMin (p);
+      max_pt.setMax (p);
+    }
+  }
+
   // common methods
+  Renderable::Renderable ()
+    : scale (1.0, 1.0, 1.0)
+    , previous_link_to_fixed (tf::Transform::getIdentity ())
+    , unchanged_frames (0)
+    , is_static (false)
+    , rendered_link_to_fixed (tf::Transform::getIdentity ())
+  {}
+
   void Renderable::setLinkName (std::string n)
   {
     name = n;
   }
 
-  void Renderable::applyTransform ()
+  void Renderable::getModelMatrix (double* m) const
   {
-    glPushMatrix ();
+    tf::Transform transform (link_to_fixed);
+    transform *= link_offset;
+    transform.getOpenGLMatrix(m);
+
+    // scale the basis vectors
+    for (int i = 0; i < 3; ++i)
+    {
+      m[i] *= scale.x ();
+      m[4+i] *= scale.y ();
+      m[8+i] *= scale.z ();
+    }
+  }
+
+  void Renderable::getBoundingSphere (tf::Vector3 &center, double &radius) const
+  {
+    geometry->getBoundingSphere (center, radius);
 
     tf::Transform transform (link_to_fixed);
     transform *= link_offset;
-    btScalar glTf[16];
-    transform.getOpenGLMatrix(glTf);
-    glMultMatrixd((GLdouble*)glTf);
+    center = transform (center * scale);
+    radius *= std::max (std::fabs (scale.x ()), std::max (std::fabs (scale.y ()), std::fabs (scale.z ())));
   }
 
-  void Renderable::unapplyTransform ()
+  void Renderable::getModelMatrix (GLfloat* m) const
   {
-    glPopMatrix ();
+    double glTf[16];
+    getModelMatrix (glTf);
+    for (int i = 0; i < 16; ++i)
+      m[i] = glTf[i];
   }
 
   // Sphere methods
   RenderableSphere::RenderableSphere (float radius)
     : radius(radius)
-  {}
+  {
+    // all spheres share a unit sphere, scaled by the model matrix
+    scale = tf::Vector3 (radius, radius, radius);
+    geometry = AssetCache::instance ().getGeometry ("sphere", &RenderableSphere::createGeometry);
+  }
 
-  void RenderableSphere::render ()
+  bool RenderableSphere::createGeometry (Geometry &geometry)
   {
-    applyTransform ();
-    glutSolidSphere(radius, 10, 10);
-    unapplyTransform ();
+    geometry.shape = Geometry::SPHERE;
+    std::vector<Geometry::Vertex> &vertices = geometry.vertices;
+    std::vector<unsigned int> &indices = geometry.indices;
+
+    // same tessellation as glutSolidSphere(radius, 10, 10)
+    const int slices = 10, stacks = 10;
+    for (int i = 0; i <= stacks; ++i)
+    {
+      double theta = M_PI * i / stacks;
+      for (int j = 0; j <= slices; ++j)
+      {
+        double phi = 2 * M_PI * j / slices;
+        float nx = sin (theta) * cos (phi);
+        float ny = sin (theta) * sin (phi);
+        float nz = cos (theta);
+        vertices.push_back (Geometry::Vertex (nx, ny, nz, nx, ny, nz));
+      }
+    }
+
+    for (int i = 0; i < stacks; ++i)
+      for (int j = 0; j < slices; ++j)
+      {
+        unsigned int a = i * (slices + 1) + j;
+        unsigned int b = a + slices + 1;
+        // skip the degenerate triangles at the poles
+        if (i > 0)
+        {
+          indices.push_back (a);
+          indices.push_back (b);
+          indices.push_back (a + 1);
+        }
+        if (i < stacks - 1)
+        {
+          indices.push_back (b);
+          indices.push_back (b + 1);
+          indices.push_back (a + 1);
+        }
+      }
+    return true;
   }
 
   // Cylinder methods
   RenderableCylinder::RenderableCylinder (float radius, float length)
     : radius(radius), length(length)
-  {}
-
-  void RenderableCylinder::render ()
-  {
-    applyTransform ();
-    glTranslatef (0, 0, -length/2);
-    //glutSolidCylinder(radius, length, 10, 10);
-    unapplyTransform ();
-  }
-
-  // Box methods
-  RenderableBox::RenderableBox (float dimx, float dimy, float dimz)
-    : dimx(dimx), dimy(dimy), dimz(dimz)
   {
-    createBoxVBO ();
+    // all cylinders share a unit cylinder, scaled by the model matrix
+    scale = tf::Vector3 (radius, radius, length);
+    geometry = AssetCache::instance ().getGeometry ("cylinder", &RenderableCylinder::createGeometry);
   }
 
-  void RenderableBox::render ()
+  bool RenderableCylinder::createGeometry (Geometry &geometry)
   {
-    applyTransform ();
-
-    glColor3f (color.r, color.g, color.b);
+    geometry.shape = Geometry::CYLINDER;
+    std::vector<Geometry::Vertex> &vertices = geometry.vertices;
+    std::vector<unsigned int> &indices = geometry.indices;
 
-    // Enable Pointers
-    glEnableClientState (GL_VERTEX_ARRAY);
-    glEnableClientState (GL_NORMAL_ARRAY);
+    // cylinder along z, centered on the link origin like in URDF
+    const int slices = 16;
+    const float h = 0.5;
 
-    glBindBuffer (GL_ARRAY_BUFFER, vbo);
-    glVertexPointer (3, GL_FLOAT, 6*sizeof(GLfloat), (char *) NULL);
-    glNormalPointer (GL_FLOAT, 6*sizeof(GLfloat), ((char *) NULL) + (3 * sizeof(GLfloat)) );
-
-    // Render
-    glDrawArrays (GL_QUADS, 0, 24);
+    // side: two rings with radial normals
+    for (int j = 0; j <= slices; ++j)
+    {
+      double phi = 2 * M_PI * j / slices;
+      float nx = cos (phi), ny = sin (phi);
+      vertices.push_back (Geometry::Vertex (nx, ny, -h, nx, ny, 0));
+      vertices.push_back (Geometry::Vertex (nx, ny,  h, nx, ny, 0));
+    }
+    for (int j = 0; j < slices; ++j)
+    {
+      unsigned int a = 2 * j;
+      indices.push_back (a);     indices.push_back (a + 2); indices.push_back (a + 3);
+      indices.push_back (a);     indices.push_back (a + 3); indices.push_back (a + 1);
+    }
 
-    // Disable Pointers
-    glDisableClientState( GL_VERTEX_ARRAY );          // Disable Vertex Arrays
-    glDisableClientState( GL_NORMAL_ARRAY );       // Disable Texture Coord Arrays
+    // caps: a center vertex and a ring each, with axial normals
+    for (int cap = 0; cap < 2; ++cap)
+    {
+      float z = cap ? h : -h;
+      float nz = cap ? 1 : -1;
+      unsigned int center = vertices.size ();
+      vertices.push_back (Geometry::Vertex (0, 0, z, 0, 0, nz));
+      for (int j = 0; j <= slices; ++j)
+      {
+        double phi = 2 * M_PI * j / slices;
+        vertices.push_back (Geometry::Vertex (cos (phi), sin (phi), z, 0, 0, nz));
+      }
+      for (int j = 0; j < slices; ++j)
+      {
+        indices.push_back (center);
+        indices.push_back (center + 1 + (cap ? j : j + 1));
+        indices.push_back (center + 1 + (cap ? j + 1 : j));
+      }
+    }
+    return true;
+  }
 
-    //glScalef (dimx, dimy, dimz);
-    //glutSolidCube (dimx);
-    unapplyTransform ();
+  // Box methods
+  RenderableBox::RenderableBox (float dimx, float dimy, float dimz)
+    : dimx(dimx), dimy(dimy), dimz(dimz)
+  {
+    // all boxes share a unit cube, scaled by the model matrix
+    scale = tf::Vector3 (dimx, dimy, dimz);
+    geometry = AssetCache::instance ().getGeometry ("box", &RenderableBox::createGeometry);
   }
 
-  void RenderableBox::createBoxVBO ()
+  bool RenderableBox::createGeometry (Geometry &geometry)
   {
-    const GLfloat boxvertices[] = 
-      {0.5f * dimx, 0.5f * dimy,-0.5f * dimz, 0.0f, 1.0f, 0.0f,          // Top Right Of The Quad (Top)
-      -0.5f * dimx, 0.5f * dimy,-0.5f * dimz, 0.0f, 1.0f, 0.0f,          // Top Left Of The Quad (Top)
-      -0.5f * dimx, 0.5f * dimy, 0.5f * dimz, 0.0f, 1.0f, 0.0f,          // Bottom Left Of The Quad (Top)
-       0.5f * dimx, 0.5f * dimy, 0.5f * dimz, 0.0f, 1.0f, 0.0f,          // Bottom Right Of The Quad (Top)
-      
-       0.5f * dimx,-0.5f * dimy, 0.5f * dimz, 0.0f,-1.0f, 0.0f,          // Top Right Of The Quad (Bottom)
-      -0.5f * dimx,-0.5f * dimy, 0.5f * dimz, 0.0f,-1.0f, 0.0f,          // Top Left Of The Quad (Bottom)
-      -0.5f * dimx,-0.5f * dimy,-0.5f * dimz, 0.0f,-1.0f, 0.0f,          // Bottom Left Of The Quad (Bottom)
-       0.5f * dimx,-0.5f * dimy,-0.5f * dimz, 0.0f,-1.0f, 0.0f,          // Bottom Right Of The Quad (Bottom)
-      
-       0.5f * dimx, 0.5f * dimy, 0.5f * dimz, 0.0f, 0.0f, 1.0f,          // Top Right Of The Quad (Front)
-      -0.5f * dimx, 0.5f * dimy, 0.5f * dimz, 0.0f, 0.0f, 1.0f,          // Top Left Of The Quad (Front)
-      -0.5f * dimx,-0.5f * dimy, 0.5f * dimz, 0.0f, 0.0f, 1.0f,          // Bottom Left Of The Quad (Front)
-       0.5f * dimx,-0.5f * dimy, 0.5f * dimz, 0.0f, 0.0f, 1.0f,          // Bottom Right Of The Quad (Front)
-      
-       0.5f * dimx,-0.5f * dimy,-0.5f * dimz, 0.0f, 0.0f,-1.0f,          // Top Right Of The Quad (Back)
-      -0.5f * dimx,-0.5f * dimy,-0.5f * dimz, 0.0f, 0.0f,-1.0f,          // Top Left Of The Quad (Back)
-      -0.5f * dimx, 0.5f * dimy,-0.5f * dimz, 0.0f, 0.0f,-1.0f,          // Bottom Left Of The Quad (Back)
-       0.5f * dimx, 0.5f * dimy,-0.5f * dimz, 0.0f, 0.0f,-1.0f,          // Bottom Right Of The Quad (Back)
-      
-      -0.5f * dimx, 0.5f * dimy, 0.5f * dimz,-1.0f, 0.0f, 0.0f,          // Top Right Of The Quad (Left)
-      -0.5f * dimx, 0.5f * dimy,-0.5f * dimz,-1.0f, 0.0f, 0.0f,          // Top Left Of The Quad (Left)
-      -0.5f * dimx,-0.5f * dimy,-0.5f * dimz,-1.0f, 0.0f, 0.0f,          // Bottom Left Of The Quad (Left)
-      -0.5f * dimx,-0.5f * dimy, 0.5f * dimz,-1.0f, 0.0f, 0.0f,          // Bottom Right Of The Quad (Left)
-      
-       0.5f * dimx, 0.5f * dimy,-0.5f * dimz, 1.0f, 0.0f, 0.0f,          // Top Right Of The Quad (Right)
-       0.5f * dimx, 0.5f * dimy, 0.5f * dimz, 1.0f, 0.0f, 0.0f,          // Top Left Of The Quad (Right)
-       0.5f * dimx,-0.5f * dimy, 0.5f * dimz, 1.0f, 0.0f, 0.0f,          // Bottom Left Of The Quad (Right)
-       0.5f * dimx,-0.5f * dimy,-0.5f * dimz, 1.0f, 0.0f, 0.0f};         // Bottom Right Of The Quad (Right)
-
-
-    glGenBuffers (1, &vbo);
-    glBindBuffer (GL_ARRAY_BUFFER, vbo);
-    glBufferData (GL_ARRAY_BUFFER, 24 * 6 * sizeof(GLfloat), boxvertices, GL_STATIC_DRAW);
+    geometry.shape = Geometry::BOX;
+    std::vector<Geometry::Vertex> &vertices = geometry.vertices;
+    std::vector<unsigned int> &indices = geometry.indices;
+
+    // four vertices per face, so every face gets its own normal
+    const float n[6][3] = {{ 0, 1, 0}, { 0,-1, 0}, { 0, 0, 1},
+                           { 0, 0,-1}, {-1, 0, 0}, { 1, 0, 0}};
+    for (int f = 0; f < 6; ++f)
+    {
+      // two tangent directions of this face
+      float u[3] = {n[f][1], n[f][2], n[f][0]};
+      float v[3] = {n[f][1] * u[2] - n[f][2] * u[1],
+                    n[f][2] * u[0] - n[f][0] * u[2],
+                    n[f][0] * u[1] - n[f][1] * u[0]};
+      unsigned int base = vertices.size ();
+      for (int c = 0; c < 4; ++c)
+      {
+        float su = (c == 1 || c == 2) ? 1 : -1;
+        float sv = (c >= 2) ? 1 : -1;
+        vertices.push_back (Geometry::Vertex (
+            0.5f * (n[f][0] + su * u[0] + sv * v[0]),
+            0.5f * (n[f][1] + su * u[1] + sv * v[1]),
+            0.5f * (n[f][2] + su * u[2] + sv * v[2]),
+            n[f][0], n[f][1], n[f][2]));
+      }
+      indices.push_back (base);     indices.push_back (base + 1); indices.push_back (base + 2);
+      indices.push_back (base);     indices.push_back (base + 2); indices.push_back (base + 3);
+    }
+    return true;
   }
 
   // these classes are copied from RVIZ. TODO: header/license/author tags
@@ -296,62 +423,46 @@ namespace realtime_urdf_filter
 
   RenderableMesh::RenderableMesh (std::string meshname)
   {
+    // the scale is part of the model matrix, so it does not matter here
+    geometry = AssetCache::instance ().getGeometry ("mesh " + meshname,
+        boost::bind (&RenderableMesh::importGeometry, meshname, _1));
+  }
+
+  bool RenderableMesh::importGeometry (const std::string &meshname, Geometry &geometry)
+  {
+    // runs on loader threads: every import has its own importer
     Assimp::Importer importer;
     importer.SetIOHandler(new ResourceIOSystem());
     const aiScene* scene = importer.ReadFile(meshname, aiProcess_SortByPType|aiProcess_GenNormals|aiProcess_Triangulate|aiProcess_GenUVCoords|aiProcess_FlipUVs);
     if (!scene)
     {
       ROS_ERROR("Could not load resource [%s]: %s", meshname.c_str(), importer.GetErrorString());
-      return;
+      return false;
     }
 
-    fromAssimpScene(scene);
-  }
-
-  RenderableMesh::SubMesh::SubMesh ()
-  {
-    vbo = INVALID_VALUE;
-    ibo = INVALID_VALUE;
-    num_indices = 0;
-  }
-
-  RenderableMesh::SubMesh::~SubMesh ()
-  {
-    if (vbo != INVALID_VALUE)
-      glDeleteBuffers (1, &vbo);
-    if (ibo != INVALID_VALUE)
-      glDeleteBuffers (1, &ibo);
-  }
-
-  void RenderableMesh::SubMesh::init (const std::vector<Vertex>& vertices,
-                                      const std::vector<unsigned int>& indices)
-  {
-    num_indices = indices.size ();
-    glGenBuffers (1, &vbo);
-    glBindBuffer (GL_ARRAY_BUFFER, vbo);
-    glBufferData (GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size (), &vertices[0], GL_STATIC_DRAW);
-
-    glGenBuffers (1, &ibo);
-    glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, ibo);
-    glBufferData (GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * num_indices, &indices[0], GL_STATIC_DRAW);
+    fromAssimpScene(scene, geometry);
+    if (geometry.indices.empty ())
+    {
+      ROS_ERROR("Resource [%s] contains no triangles", meshname.c_str());
+      return false;
+    }
+    return true;
   }
 
-  void RenderableMesh::fromAssimpScene (const aiScene* scene)
+  void RenderableMesh::fromAssimpScene (const aiScene* scene, Geometry &geometry)
   {
-    meshes.resize (scene->mNumMeshes);
-    for (unsigned int i = 0; i < meshes.size (); ++i)
-    {
-      const aiMesh* mesh = scene->mMeshes[i];
-      initMesh (i, mesh);
-    }
+    // all sub meshes end up in one vertex and index buffer
+    for (unsigned int i = 0; i < scene->mNumMeshes; ++i)
+      initMesh (scene->mMeshes[i], geometry);
   }
 
-  void RenderableMesh::initMesh (unsigned int index, const aiMesh* mesh)
+  void RenderableMesh::initMesh (const aiMesh* mesh, Geometry &geometry)
   {
     // TODO: mesh->mMaterialIndex
     // TODO: const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
-    std::vector<Vertex> vertices;
-    std::vector<unsigned int> indices;
+    std::vector<Geometry::Vertex> &vertices = geometry.vertices;
+    std::vector<unsigned int> &indices = geometry.indices;
+    unsigned int base = vertices.size ();
 
     for (unsigned int i = 0; i < mesh->mNumVertices; ++i)
     {
@@ -359,60 +470,26 @@ namespace realtime_urdf_filter
       const aiVector3D* n = &(mesh->mNormals[i]);
       // TODO: const aiVector3D* pTexCoord = mesh->HasTextureCoords(0) ? &(mesh->mTextureCoords[0][i]) : &Zero3D;
 
-      Vertex v(pos->x, pos->y, pos->z, n->x, n->y, n->z);
+      Geometry::Vertex v(pos->x, pos->y, pos->z, n->x, n->y, n->z);
       vertices.push_back (v);
     }
 
     for (unsigned int i = 0 ; i < mesh->mNumFaces ; ++i)
     {
         const aiFace& face = mesh->mFaces[i];
-        assert(face.mNumIndices == 3);
-        indices.push_back(face.mIndices[0]);
-        indices.push_back(face.mIndices[1]);
-        indices.push_back(face.mIndices[2]);
+        // aiProcess_SortByPType keeps points and lines in separate meshes
+        if (face.mNumIndices != 3)
+          continue;
+        indices.push_back(base + face.mIndices[0]);
+        indices.push_back(base + face.mIndices[1]);
+        indices.push_back(base + face.mIndices[2]);
     }
-
-    meshes[index].init (vertices, indices);
   }
 
   void RenderableMesh::setScale (float x, float y, float z)
   {
-    scale_x = x;
-    scale_y = y;
-    scale_z = z;
+    scale = tf::Vector3 (x, y, z);
   }
 
-  void RenderableMesh::render ()
-  {
-    applyTransform ();
-    glScalef (scale_x, scale_y, scale_z);
-    glEnableVertexAttribArray (0);
-    glEnableVertexAttribArray (2);
-
-    for (unsigned int i = 0 ; i < meshes.size() ; i++)
-    {
-      glBindBuffer (GL_ARRAY_BUFFER, meshes[i].vbo);
-      glVertexAttribPointer (0, 3, GL_FLOAT, GL_FALSE, sizeof (Vertex), 0);
-      glVertexAttribPointer (2, 3, GL_FLOAT, GL_FALSE, sizeof (Vertex), (const GLvoid*) (sizeof(float)*3));
-
-      glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, meshes[i].ibo);
-
-//      const unsigned int MaterialIndex = meshes[i].MaterialIndex;
-//
-//      if (MaterialIndex < textures.size() && textures[MaterialIndex])
-//      {
-//        textures[MaterialIndex]->Bind (GL_TEXTURE0);
-//      }
-
-      glDrawElements (GL_TRIANGLES, meshes[i].num_indices, GL_UNSIGNED_INT, 0);
-    }
-
-    glDisableVertexAttribArray (0);
-    glDisableVertexAttribArray (2);
-    unapplyTransform ();
-  }
-
-
 }
 
-
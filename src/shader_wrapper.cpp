@@ -59,6 +59,18 @@ ShaderWrapper ShaderWrapper::fromFiles (const char* vertex_file, const char* fra
   return ShaderWrapper (vs, fs);
 }
 
+// compiles from files with additional preprocessor definitions
+boost::shared_ptr<ShaderWrapper> ShaderWrapper::create
+  (const std::string &vertex_file, const std::string &fragment_file, const std::string &defines)
+{
+  std::string v_source = inject_defines (load_text_file (vertex_file), defines);
+  std::string f_source = inject_defines (load_text_file (fragment_file), defines);
+
+  const GLchar* vs[1] = {v_source.c_str () };
+  const GLchar* fs[1] = {f_source.c_str () };
+  return boost::shared_ptr<ShaderWrapper> (new ShaderWrapper (vs, fs));
+}
+
 // make sure we delete everything upon deconstruction
 ShaderWrapper::~ShaderWrapper()
 {
@@ -91,6 +103,26 @@ void ShaderWrapper::SetUniformVal1f(std::string name, GLfloat val)
   glUniform1f(glGetUniformLocation(prog, name.c_str()), val);
 }
 
+// convenience function to set a vec2 uniform value
+void ShaderWrapper::SetUniformVal2f(std::string name, GLfloat x, GLfloat y)
+{
+  glUniform2f(glGetUniformLocation(prog, name.c_str()), x, y);
+}
+
+// convenience function to set a vec4 uniform value
+void ShaderWrapper::SetUniformVal4f(std::string name, GLfloat x, GLfloat y, GLfloat z, GLfloat w)
+{
+  glUniform4f(glGetUniformLocation(prog, name.c_str()), x, y, z, w);
+}
+
+// connects a uniform block to a uniform buffer binding point
+void ShaderWrapper::BindUniformBlock(std::string name, GLuint binding)
+{
+  GLuint index = glGetUniformBlockIndex(prog, name.c_str());
+  if (index != GL_INVALID_INDEX)
+    glUniformBlockBinding(prog, index, binding);
+}
+
 // templated constructor takes two char* arrays for vertex and fragment shader source code
 template <int L1, int L2>
 ShaderWrapper::ShaderWrapper (GLchar const * (&v_source) [L1], GLchar const * (&f_source) [L2])
@@ -163,6 +195,51 @@ std::string ShaderWrapper::load_text_file (std::string file_name)
   //return str;
 }
 
+// inserts defines after the #version line, which has to stay first
+std::string ShaderWrapper::inject_defines (const std::string &source, const std::string &defines)
+{
+  std::string::size_type pos = source.find ("#version");
+  if (pos == std::string::npos)
+    return defines + source;
+
+  pos = source.find ('\n', pos);
+  if (pos == std::string::npos)
+    return source + "\n" + defines;
+  return source.substr (0, pos + 1) + defines + source.substr (pos + 1);
+}
+
+ShaderPermutations::ShaderPermutations (const std::string &vertex_file, const std::string &fragment_file,
+                                        const std::vector<std::string> &flags)
+  : vertex_file_ (vertex_file)
+  , fragment_file_ (fragment_file)
+  , flags_ (flags)
+{
+}
+
+// returns the variant for key, compiling it if needed
+ShaderWrapper& ShaderPermutations::get (unsigned key, bool &created)
+{
+  std::map<unsigned, boost::shared_ptr<ShaderWrapper> >::iterator it = variants_.find (key);
+  created = (it == variants_.end ());
+  if (!created)
+    return *it->second;
+
+  std::string defines;
+  for (unsigned int i = 0; i < flags_.size (); ++i)
+    if (key & (1u << i))
+      defines += "#define " + flags_[i] + "\n";
+
+  boost::shared_ptr<ShaderWrapper> variant = ShaderWrapper::create (vertex_file_, fragment_file_, defines);
+  variants_[key] = variant;
+  return *variant;
+}
+
+// number of variants compiled so far
+unsigned ShaderPermutations::size () const
+{
+  return variants_.size ();
+}
+
 } // end namespace
 
 
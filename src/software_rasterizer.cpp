@@ -0,0 +1,357 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <realtime_urdf_filter/software_rasterizer.h>
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace realtime_urdf_filter
+{
+  SoftwareRasterizer::SoftwareRasterizer (unsigned int num_threads)
+    : width_ (0), height_ (0), stride_ (0)
+    , tiles_x_ (0), tiles_y_ (0)
+    , pool_ (num_threads)
+  {
+    std::fill (projection_, projection_ + 16, 0.0);
+    projection_[0] = projection_[5] = projection_[10] = projection_[15] = 1.0;
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief (re)allocates depth buffer, coverage buffer and tile bins */
+  void SoftwareRasterizer::resize (int width, int height)
+  {
+    width_ = width;
+    height_ = height;
+    // pad rows to a multiple of 4 pixels so SSE groups never straddle rows
+    stride_ = (width + 3) & ~3;
+    tiles_x_ = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tiles_y_ = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    depth_.resize (stride_ * height_);
+    coverage_.resize (stride_ * height_);
+    bins_.resize (tiles_x_ * tiles_y_);
+  }
+
+  void SoftwareRasterizer::setProjection (const double* projection)
+  {
+    std::copy (projection, projection + 16, projection_);
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief maps an eye space distance to window depth, like the GL pipeline */
+  float SoftwareRasterizer::windowDepth (double z) const
+  {
+    // the camera looks down negative z in eye space
+    double clip_z = projection_[10] * -z + projection_[14];
+    double clip_w = projection_[11] * -z + projection_[15];
+    return float ((clip_z / clip_w) * 0.5 + 0.5);
+  }
+
+  void SoftwareRasterizer::clear (float depth)
+  {
+    std::fill (depth_.begin (), depth_.end (), depth);
+    std::fill (coverage_.begin (), coverage_.end (), 0);
+    triangles_.clear ();
+    for (unsigned int i = 0; i < bins_.size (); ++i)
+      bins_[i].clear ();
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief transforms triangles to clip space, clips them against the near
+   * and far planes and sets up the resulting screen space triangles */
+  void SoftwareRasterizer::addTriangles (const std::vector<float> &xyz, const double* modelview)
+  {
+    // combined modelview projection, column major
+    double mvp[16];
+    for (int c = 0; c < 4; ++c)
+      for (int r = 0; r < 4; ++r)
+      {
+        double s = 0.0;
+        for (int k = 0; k < 4; ++k)
+          s += projection_[k*4 + r] * modelview[c*4 + k];
+        mvp[c*4 + r] = s;
+      }
+
+    const unsigned int num_triangles = xyz.size () / 9;
+    for (unsigned int t = 0; t < num_triangles; ++t)
+    {
+      // polygon in clip space, a triangle clipped by two planes has at most 5 vertices
+      double poly[2][5][4];
+      int n = 3;
+      for (int v = 0; v < 3; ++v)
+      {
+        const float* p = &xyz[t*9 + v*3];
+        for (int r = 0; r < 4; ++r)
+          poly[0][v][r] = mvp[r] * p[0] + mvp[4+r] * p[1] + mvp[8+r] * p[2] + mvp[12+r];
+      }
+
+      // clip against z >= -w (near) and z <= w (far)
+      int cur = 0;
+      for (int plane = 0; plane < 2 && n > 0; ++plane)
+      {
+        double sign = (plane == 0) ? 1.0 : -1.0;
+        int m = 0;
+        for (int i = 0; i < n; ++i)
+        {
+          const double* a = poly[cur][i];
+          const double* b = poly[cur][(i + 1) % n];
+          double da = sign * a[2] + a[3];
+          double db = sign * b[2] + b[3];
+          if (da >= 0)
+            std::copy (a, a + 4, poly[1-cur][m++]);
+          if ((da >= 0) != (db >= 0))
+          {
+            double s = da / (da - db);
+            for (int r = 0; r < 4; ++r)
+              poly[1-cur][m][r] = a[r] + s * (b[r] - a[r]);
+            ++m;
+          }
+        }
+        n = m;
+        cur = 1 - cur;
+      }
+      if (n < 3)
+        continue;
+
+      // perspective divide and viewport transform
+      float win[5][3];
+      for (int i = 0; i < n; ++i)
+      {
+        const double* p = poly[cur][i];
+        win[i][0] = float ((p[0] / p[3] * 0.5 + 0.5) * width_);
+        win[i][1] = float ((p[1] / p[3] * 0.5 + 0.5) * height_);
+        win[i][2] = float (p[2] / p[3] * 0.5 + 0.5);
+      }
+
+      for (int i = 1; i + 1 < n; ++i)
+        setupTriangle (win[0], win[i], win[i+1]);
+    }
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief computes edge functions, depth plane and bounding box of a screen
+   * space triangle and adds it to the bins of all tiles it overlaps */
+  void SoftwareRasterizer::setupTriangle (const float* v0, const float* v1, const float* v2)
+  {
+    float area = (v1[0] - v0[0]) * (v2[1] - v0[1]) - (v2[0] - v0[0]) * (v1[1] - v0[1]);
+    if (area == 0.0f)
+      return;
+
+    // no face culling, just make the winding counter clockwise
+    if (area < 0.0f)
+    {
+      std::swap (v1, v2);
+      area = -area;
+    }
+
+    Triangle tri;
+    tri.x0 = std::max (0, int (std::floor (std::min (v0[0], std::min (v1[0], v2[0])))));
+    tri.y0 = std::max (0, int (std::floor (std::min (v0[1], std::min (v1[1], v2[1])))));
+    tri.x1 = std::min (width_ - 1, int (std::ceil (std::max (v0[0], std::max (v1[0], v2[0])))));
+    tri.y1 = std::min (height_ - 1, int (std::ceil (std::max (v0[1], std::max (v1[1], v2[1])))));
+    if (tri.x0 > tri.x1 || tri.y0 > tri.y1)
+      return;
+
+    const float* v[3] = {v0, v1, v2};
+    for (int i = 0; i < 3; ++i)
+    {
+      const float* a = v[i];
+      const float* b = v[(i + 1) % 3];
+      tri.ea[i] = a[1] - b[1];
+      tri.eb[i] = b[0] - a[0];
+      tri.ec[i] = a[0] * b[1] - a[1] * b[0];
+      // top-left fill rule: pixels exactly on a left or top edge are inside,
+      // on all other edges the edge function has to be strictly positive
+      bool top_left = (tri.ea[i] > 0.0f) || (tri.ea[i] == 0.0f && tri.eb[i] > 0.0f);
+      tri.bias[i] = top_left ? 0.0f : std::numeric_limits<float>::min ();
+    }
+
+    float dz1 = v1[2] - v0[2];
+    float dz2 = v2[2] - v0[2];
+    tri.za = (dz1 * (v2[1] - v0[1]) - dz2 * (v1[1] - v0[1])) / area;
+    tri.zb = (dz2 * (v1[0] - v0[0]) - dz1 * (v2[0] - v0[0])) / area;
+    tri.zc = v0[2] - tri.za * v0[0] - tri.zb * v0[1];
+
+    unsigned int index = triangles_.size ();
+    triangles_.push_back (tri);
+    for (int ty = tri.y0 / TILE_SIZE; ty <= tri.y1 / TILE_SIZE; ++ty)
+      for (int tx = tri.x0 / TILE_SIZE; tx <= tri.x1 / TILE_SIZE; ++tx)
+        bins_[ty * tiles_x_ + tx].push_back (index);
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief rasterizes all tiles in parallel. tiles never share pixels, so
+   * the workers need no synchronization */
+  void SoftwareRasterizer::rasterize ()
+  {
+    pool_.run (boost::bind (&SoftwareRasterizer::rasterizeTile, this, _1), tiles_x_ * tiles_y_);
+  }
+
+  void SoftwareRasterizer::rasterizeTile (unsigned int tile)
+  {
+    const std::vector<unsigned int> &bin = bins_[tile];
+    const int tile_x = (tile % tiles_x_) * TILE_SIZE;
+    const int tile_y = (tile / tiles_x_) * TILE_SIZE;
+
+    for (unsigned int t = 0; t < bin.size (); ++t)
+    {
+      const Triangle &tri = triangles_[bin[t]];
+      // TILE_SIZE is a multiple of 4, so aligning x0 down stays inside the tile
+      const int x0 = std::max (tri.x0, tile_x) & ~3;
+      const int x1 = std::min (tri.x1, tile_x + TILE_SIZE - 1);
+      const int y0 = std::max (tri.y0, tile_y);
+      const int y1 = std::min (tri.y1, tile_y + TILE_SIZE - 1);
+
+#ifdef __SSE2__
+      const __m128 offsets = _mm_set_ps (3.5f, 2.5f, 1.5f, 0.5f);
+      __m128 ea[3], eb[3], ec[3], bias[3];
+      for (int i = 0; i < 3; ++i)
+      {
+        ea[i] = _mm_set1_ps (tri.ea[i]);
+        eb[i] = _mm_set1_ps (tri.eb[i]);
+        ec[i] = _mm_set1_ps (tri.ec[i]);
+        bias[i] = _mm_set1_ps (tri.bias[i]);
+      }
+      const __m128 za = _mm_set1_ps (tri.za);
+      const __m128 zb = _mm_set1_ps (tri.zb);
+      const __m128 zc = _mm_set1_ps (tri.zc);
+
+      for (int y = y0; y <= y1; ++y)
+      {
+        const __m128 py = _mm_set1_ps (y + 0.5f);
+        __m128 row[3];
+        for (int i = 0; i < 3; ++i)
+          row[i] = _mm_add_ps (_mm_mul_ps (eb[i], py), ec[i]);
+        const __m128 zrow = _mm_add_ps (_mm_mul_ps (zb, py), zc);
+
+        float* depth = &depth_[y * stride_];
+        unsigned char* coverage = &coverage_[y * stride_];
+        for (int x = x0; x <= x1; x += 4)
+        {
+          const __m128 px = _mm_add_ps (_mm_set1_ps (float (x)), offsets);
+          __m128 mask = _mm_cmpge_ps (_mm_add_ps (_mm_mul_ps (ea[0], px), row[0]), bias[0]);
+          mask = _mm_and_ps (mask, _mm_cmpge_ps (_mm_add_ps (_mm_mul_ps (ea[1], px), row[1]), bias[1]));
+          mask = _mm_and_ps (mask, _mm_cmpge_ps (_mm_add_ps (_mm_mul_ps (ea[2], px), row[2]), bias[2]));
+          if (_mm_movemask_ps (mask) == 0)
+            continue;
+
+          const __m128 z = _mm_add_ps (_mm_mul_ps (za, px), zrow);
+          const __m128 old_z = _mm_loadu_ps (depth + x);
+          mask = _mm_and_ps (mask, _mm_cmplt_ps (z, old_z));
+          const int bits = _mm_movemask_ps (mask);
+          if (bits == 0)
+            continue;
+
+          _mm_storeu_ps (depth + x, _mm_or_ps (_mm_and_ps (mask, z), _mm_andnot_ps (mask, old_z)));
+          for (int i = 0; i < 4; ++i)
+            if (bits & (1 << i))
+              coverage[x + i] = 1;
+        }
+      }
+#else
+      for (int y = y0; y <= y1; ++y)
+      {
+        const float py = y + 0.5f;
+        float* depth = &depth_[y * stride_];
+        unsigned char* coverage = &coverage_[y * stride_];
+        for (int x = x0; x <= x1; ++x)
+        {
+          const float px = x + 0.5f;
+          bool inside = true;
+          for (int i = 0; i < 3; ++i)
+            inside &= (tri.ea[i] * px + tri.eb[i] * py + tri.ec[i] >= tri.bias[i]);
+          if (!inside)
+            continue;
+
+          const float z = tri.za * px + tri.zb * py + tri.zc;
+          if (z < depth[x])
+          {
+            depth[x] = z;
+            coverage[x] = 1;
+          }
+        }
+      }
+#endif
+    }
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief applies the depth comparison of urdf_filter.frag to the rendered
+   * depth buffer, split into chunks of rows for the workers */
+  void SoftwareRasterizer::compare (const float* sensor_depth, float z_near, float z_far,
+                                    float max_diff, float replace_value,
+                                    float* out_depth, unsigned char* out_mask)
+  {
+    compare_args_.sensor_depth = sensor_depth;
+    compare_args_.z_near = z_near;
+    compare_args_.z_far = z_far;
+    compare_args_.max_diff = max_diff;
+    compare_args_.replace_value = replace_value;
+    compare_args_.out_depth = out_depth;
+    compare_args_.out_mask = out_mask;
+    pool_.run (boost::bind (&SoftwareRasterizer::compareRows, this, _1), tiles_y_);
+  }
+
+  void SoftwareRasterizer::compareRows (unsigned int chunk)
+  {
+    const CompareArgs &args = compare_args_;
+    const float a = args.z_near * args.z_far / (args.z_near - args.z_far);
+    const float b = args.z_far / (args.z_far - args.z_near);
+
+    const int y0 = chunk * TILE_SIZE;
+    const int y1 = std::min (height_, y0 + int (TILE_SIZE));
+    for (int y = y0; y < y1; ++y)
+    {
+      const float* depth = &depth_[y * stride_];
+      const unsigned char* coverage = &coverage_[y * stride_];
+      const float* sensor = args.sensor_depth + y * width_;
+      float* out = args.out_depth ? args.out_depth + y * width_ : NULL;
+      unsigned char* mask = args.out_mask ? args.out_mask + y * width_ : NULL;
+
+      for (int x = 0; x < width_; ++x)
+      {
+        if (out)
+        {
+          float virtual_depth = a / (depth[x] - b);
+          out[x] = (virtual_depth - sensor[x] > args.max_diff) ? sensor[x] : args.replace_value;
+        }
+        if (mask)
+          mask[x] = coverage[x] ? 255 : 0;
+      }
+    }
+  }
+
+} // end namespace
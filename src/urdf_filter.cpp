@@ -29,9 +29,21 @@
  */
 
 #include "realtime_urdf_filter/urdf_filter.h"
+#include "realtime_urdf_filter/asset_cache.h"
+#include "realtime_urdf_filter/worker_pool.h"
 
 #include <cv_bridge/cv_bridge.h>
 #include <sensor_msgs/image_encodings.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <set>
+#include <sstream>
 
 //#define USE_OWN_CALIBRATION
 
@@ -39,29 +51,29 @@ using namespace realtime_urdf_filter;
 
 // constructor. sets up ros and reads in parameters
 RealtimeURDFFilter::RealtimeURDFFilter (ros::NodeHandle &nh, int argc, char **argv)
-  : nh_(nh)
-  , fbo_initialized_(false)
-  , depth_image_pbo_ (GL_INVALID_VALUE)
-  , far_plane_ (8)
-  , near_plane_ (0.1)
+  : nh_(&nh)
+  , tf_listener_ (new tf::TransformListener)
+  , tf_ (tf_listener_.get ())
   , argc_ (argc), argv_(argv)
 {
+  setDefaults ();
+
   // get fixed frame name
   XmlRpc::XmlRpcValue v;
-  nh_.getParam ("fixed_frame", v);
+  nh_->getParam ("fixed_frame", v);
   ROS_ASSERT (v.getType() == XmlRpc::XmlRpcValue::TypeString && "fixed_frame paramter!");
   fixed_frame_ = (std::string)v;
   ROS_INFO ("using fixed frame %s", fixed_frame_.c_str ());
 
   // get camera frame name 
   // we do not read this from ROS message, for being able to run this within openni (self filtered tracker..)
-  nh_.getParam ("camera_frame", v);
+  nh_->getParam ("camera_frame", v);
   ROS_ASSERT (v.getType() == XmlRpc::XmlRpcValue::TypeString && "need a camera_frame paramter!");
   cam_frame_ = (std::string)v;
   ROS_INFO ("using camera frame %s", cam_frame_.c_str ());
 
   // read additional camera offset (TODO: make optional)
-  nh_.getParam ("camera_offset", v);
+  nh_->getParam ("camera_offset", v);
   ROS_ASSERT (v.getType() == XmlRpc::XmlRpcValue::TypeStruct && "need a camera_offset paramter!");
   ROS_ASSERT (v.hasMember ("translation") && v.hasMember ("rotation") && "camera offset needs a translation and rotation parameter!");
 
@@ -82,40 +94,367 @@ RealtimeURDFFilter::RealtimeURDFFilter (ros::NodeHandle &nh, int argc, char **ar
   camera_offset_q_ = tf::Quaternion((double)vec[0], (double)vec[1], (double)vec[2], (double)vec[3]);
 
   // depth distance threshold (how far from the model are points still deleted?)
-  nh_.getParam ("depth_distance_threshold", v);
+  nh_->getParam ("depth_distance_threshold", v);
   ROS_ASSERT (v.getType() == XmlRpc::XmlRpcValue::TypeDouble && "need a depth_distance_threshold paramter!");
   depth_distance_threshold_ = (double)v;
   ROS_INFO ("using depth distance threshold %f", depth_distance_threshold_);
 
   // depth distance threshold (how far from the model are points still deleted?)
-  nh_.getParam ("show_gui", v);
+  nh_->getParam ("show_gui", v);
   ROS_ASSERT (v.getType() == XmlRpc::XmlRpcValue::TypeBoolean && "need a show_gui paramter!");
   show_gui_ = (bool)v;
   ROS_INFO ("showing gui / visualization: %s", (show_gui_?"ON":"OFF"));
 
+  // OpenGL context backend: "glut" (needs X), "egl" or "osmesa" (headless)
+  nh_->param<std::string> ("context_backend", context_backend_, "glut");
+  ROS_INFO ("using OpenGL context backend %s", context_backend_.c_str ());
+
+  // render backend: "gl" renders on the GPU, "cpu" uses the software rasterizer
+  std::string render_backend;
+  nh_->param<std::string> ("render_backend", render_backend, "gl");
+  if (render_backend == "cpu")
+    cpu_render_ = true;
+  else if (render_backend != "gl")
+    ROS_WARN ("unknown render_backend '%s', using 'gl'", render_backend.c_str ());
+  int threads;
+  nh_->param ("cpu_render_threads", threads, 0);
+  cpu_render_threads_ = std::max (0, threads);
+  ROS_INFO ("rendering on the %s", (cpu_render_?"CPU":"GPU"));
+
   // fitler replace value
-  nh_.getParam ("filter_replace_value", v);
+  nh_->getParam ("filter_replace_value", v);
   ROS_ASSERT (v.getType() == XmlRpc::XmlRpcValue::TypeDouble && "need a filter_replace_value paramter!");
   filter_replace_value_ = (double)v;
   ROS_INFO ("using filter replace value %f", filter_replace_value_);
 
+  // readback mode: "blocking" for lowest latency, "deferred" for highest throughput,
+  // "sparse" only transfers the image tiles covered by the models
+  std::string readback_mode;
+  nh_->param<std::string> ("readback_mode", readback_mode, "blocking");
+  if (readback_mode == "deferred")
+    deferred_readback_ = true;
+  else if (readback_mode == "sparse")
+    sparse_readback_ = true;
+  else if (readback_mode != "blocking")
+  {
+    ROS_WARN ("unknown readback_mode '%s', using 'blocking'", readback_mode.c_str ());
+    readback_mode = "blocking";
+  }
+  ROS_INFO ("using %s readback", readback_mode.c_str ());
+
+  // spheres and cylinders are ray-cast exactly instead of drawn tessellated
+  nh_->param ("primitive_impostors", primitive_impostors_, true);
+
+  // start filtering with collision primitives while the meshes load
+  nh_->param ("progressive_loading", progressive_loading_, true);
+
+  // render the depth of models that do not move only once
+  nh_->param ("static_layer", static_layer_, true);
+
+  // skip rendering while nothing moved by more than this (meters / rotation
+  // matrix entries), negative to render every frame
+  nh_->param ("temporal_reuse_epsilon", temporal_reuse_epsilon_, 1e-4);
+
+  // encoding of the filtered depth image
+  std::string output_encoding;
+  nh_->param<std::string> ("output_encoding", output_encoding, sensor_msgs::image_encodings::TYPE_32FC1);
+  if (output_encoding == sensor_msgs::image_encodings::TYPE_16UC1)
+    output_16u_ = true;
+  else if (output_encoding != sensor_msgs::image_encodings::TYPE_32FC1)
+    ROS_WARN ("unknown output_encoding '%s', using '32FC1'", output_encoding.c_str ());
+
+  // precompiled models, written by urdf_filter_bundle
+  std::string scene_bundle;
+  nh_->param<std::string> ("scene_bundle", scene_bundle, "");
+  if (!scene_bundle.empty () && !AssetCache::instance ().loadBundle (scene_bundle))
+    ROS_WARN ("could not load scene bundle %s, parsing all models", scene_bundle.c_str ());
+
   // setup publishers 
   // TODO: make these topics parameters
-  mask_pub_ = nh_.advertise<sensor_msgs::Image> ("output_mask", 10);
-  depth_pub_ = nh_.advertise<sensor_msgs::Image> ("output", 10);
+  mask_pub_ = nh_->advertise<sensor_msgs::Image> ("output_mask", 10);
+  depth_pub_ = nh_->advertise<sensor_msgs::Image> ("output", 10);
+
+  // latency percentiles are published at a low rate
+  nh_->param ("diagnostics_period", diagnostics_period_, 1.0);
+  diagnostics_pub_ = nh_->advertise<diagnostic_msgs::DiagnosticArray> ("/diagnostics", 1);
+  last_diagnostics_ = ros::WallTime::now ();
+}
+
+// constructor for offline use, does not talk to the ROS master at all
+RealtimeURDFFilter::RealtimeURDFFilter (tf::Transformer &tf, int argc, char **argv)
+  : nh_(NULL)
+  , tf_ (&tf)
+  , argc_ (argc), argv_(argv)
+{
+  setDefaults ();
 }
 
+// default values for everything that is not read from the parameter server
+void RealtimeURDFFilter::setDefaults ()
+{
+  cpu_render_ = false;
+  cpu_render_threads_ = 0;
+  rasterizer_ = NULL;
+  context_ = NULL;
+  fbo_ = NULL;
+  fbo_initialized_ = false;
+
+  for (int i = 0; i < UPLOAD_RING_SIZE; ++i)
+  {
+    depth_image_pbo_[i] = GL_INVALID_VALUE;
+    depth_texture_[i] = GL_INVALID_VALUE;
+    upload_fence_[i] = 0;
+    upload_ptr_[i] = 0;
+  }
+  upload_slot_ = 0;
+  upload_size_ = 0;
+  upload_format_ = GL_R32F;
+  persistent_upload_ = false;
+
+  camera_offset_t_ = tf::Vector3 (0, 0, 0);
+  camera_offset_q_ = tf::Quaternion (0, 0, 0, 1);
+  cam_frame_ = "/camera";
+  fixed_frame_ = "/world";
+  context_backend_ = "glut";
+  show_gui_ = false;
+  primitive_impostors_ = true;
+  progressive_loading_ = false;
+
+  need_mask_ = false;
+  need_depth_ = true;
+  force_depth_output_ = true;
+  force_mask_output_ = false;
+
+  width_ = 0;
+  height_ = 0;
+
+  far_plane_ = 8;
+  near_plane_ = 0.1;
+  depth_distance_threshold_ = 0.05;
+  filter_replace_value_ = 0.0;
+
+  masked_depth_ = NULL;
+  mask_ = NULL;
+
+  input_16u_ = false;
+  output_16u_ = false;
+  readback_16u_ = false;
+  masked_depth_16u_ = NULL;
+
+  deferred_readback_ = false;
+  for (int i = 0; i < READBACK_RING_SIZE; ++i)
+  {
+    readback_pbo_[i] = GL_INVALID_VALUE;
+    readback_fence_[i] = 0;
+    readback_has_mask_[i] = false;
+    readback_has_depth_[i] = false;
+  }
+  readback_slot_ = 0;
+  readback_size_ = 0;
+
+  sparse_readback_ = false;
+  tile_texture_ = GL_INVALID_VALUE;
+  tiles_x_ = tiles_y_ = 0;
+
+  static_layer_ = false;
+  static_layer_valid_ = false;
+  static_fbo_ = GL_INVALID_VALUE;
+  static_depth_texture_ = GL_INVALID_VALUE;
+  for (int i = 0; i < 16; ++i)
+    static_projection_[i] = 0.0;
+
+  temporal_reuse_epsilon_ = -1.0;
+  virtual_depth_valid_ = false;
+  virtual_depth_outputs_ = 0;
+  for (int i = 0; i < 16; ++i)
+    virtual_depth_projection_[i] = 0.0;
+
+  diagnostics_period_ = 1.0;
+  last_diagnostics_ = ros::WallTime::now ();
+  frames_since_diagnostics_ = 0;
+
+  camera_ubo_ = GL_INVALID_VALUE;
+  quad_vao_ = quad_vbo_ = GL_INVALID_VALUE;
+
+  for (int i = 0; i < 2; ++i)
+  {
+    gpu_timer_query_[i] = GL_INVALID_VALUE;
+    gpu_timer_pending_[i] = false;
+  }
+  gpu_timer_index_ = 0;
+}
+
+
 RealtimeURDFFilter::~RealtimeURDFFilter ()
 {
-  delete masked_depth_;
-  delete mask_;
+  stopMeshLoader ();
+  joint_state_subs_.clear ();
+  for (unsigned int i = 0; i < renderers_.size (); ++i)
+    delete renderers_[i];
+  delete rasterizer_;
+  free (masked_depth_);
+  free (mask_);
+  free (masked_depth_16u_);
+}
+
+// adds a URDF model that is loaded in addition to the ones from the "models" parameter
+void RealtimeURDFFilter::addModel (const std::string &description, const std::string &tf_prefix)
+{
+  model_descriptions_.push_back (std::make_pair (description, tf_prefix));
 }
 
 // loads URDF models
 void RealtimeURDFFilter::loadModels ()
+{
+  // start from scratch, this is called again when the image size changes
+  stopMeshLoader ();
+  joint_state_subs_.clear ();
+  for (unsigned int i = 0; i < renderers_.size (); ++i)
+    delete renderers_[i];
+  renderers_.clear ();
+
+  std::vector<std::pair<std::string, std::string> > models;
+  std::map<std::string, std::string> joint_state_topics;
+  if (nh_)
+    readModelParameters (models, joint_state_topics);
+  models.insert (models.end (), model_descriptions_.begin (), model_descriptions_.end ());
+
+  // CPU phase: parse all descriptions, then import the meshes of all models
+  // as one batch of jobs, so the models do not wait for each other. the
+  // renderers then find every mesh in the AssetCache. with progressive
+  // loading, meshes that are not cached yet are deferred instead. nothing
+  // here needs the GL context, the geometry is uploaded by the first
+  // scene_.render ()
+  ros::WallTime load_start = ros::WallTime::now ();
+  {
+    WorkerPool pool;
+    pool.run (boost::bind (&RealtimeURDFFilter::parseModelJob, &models, _1), models.size ());
+    if (!progressive_loading_)
+    {
+      std::vector<std::string> meshes;
+      collectMeshes (models, meshes);
+      pool.run (boost::bind (&RealtimeURDFFilter::importMeshJob, &meshes, _1), meshes.size ());
+    }
+    for (unsigned int i = 0; i < models.size (); ++i)
+      renderers_.push_back (new URDFRenderer (models[i].first, models[i].second, cam_frame_, fixed_frame_, *tf_, &pool,
+                                              progressive_loading_));
+  }
+  ROS_INFO ("loaded %u models in %f s", (unsigned int) models.size (), (ros::WallTime::now () - load_start).toSec ());
+
+  // models with joint states are posed by forward kinematics instead of a
+  // TF lookup per link
+  for (unsigned int i = 0; i < models.size () && nh_; ++i)
+  {
+    std::map<std::string, std::string>::const_iterator topic = joint_state_topics.find (models[i].second);
+    if (topic == joint_state_topics.end ())
+      continue;
+    ROS_INFO ("posing %s from joint states on %s", models[i].second.c_str (), topic->second.c_str ());
+    joint_state_subs_.push_back (nh_->subscribe<sensor_msgs::JointState> (topic->second, 1,
+        boost::bind (&URDFRenderer::setJointState, renderers_[i], _1)));
+  }
+
+  // identical geometry of all models is drawn instanced
+  scene_.setImpostors (primitive_impostors_ && !cpu_render_);
+  buildScene ();
+
+  // progressive loading: the deferred meshes are imported in the background
+  // and swapped in by updateTransforms ()
+  unsigned int pending = 0;
+  for (unsigned int i = 0; i < renderers_.size (); ++i)
+    pending += renderers_[i]->numPendingLinks ();
+  if (pending > 0)
+  {
+    ROS_INFO ("loading %u meshes in the background", pending);
+    mesh_loader_ = boost::thread (boost::bind (&RealtimeURDFFilter::loadPendingMeshes, this));
+  }
+
+  // forget models and meshes that are no longer used by any renderer
+  AssetCache &assets = AssetCache::instance ();
+  assets.prune ();
+  ROS_INFO ("asset cache: %u models, %u geometries, %u hits, %u misses",
+      assets.numModels (), assets.numGeometries (), assets.numHits (), assets.numMisses ());
+  metrics_.setCounter ("unique geometries", assets.numGeometries ());
+}
+
+// packs the renderables of all models for instanced drawing
+void RealtimeURDFFilter::buildScene ()
+{
+  scene_.build (renderers_);
+  metrics_.setCounter ("batches", scene_.numBatches ());
+  metrics_.setCounter ("instances", scene_.numInstances ());
+  static_layer_valid_ = false;
+  virtual_depth_valid_ = false;
+
+  unsigned int pending = 0;
+  for (unsigned int i = 0; i < renderers_.size (); ++i)
+    pending += renderers_[i]->numPendingLinks ();
+  metrics_.setCounter ("pending links", pending);
+}
+
+// body of mesh_loader_: imports the deferred meshes of all models
+void RealtimeURDFFilter::loadPendingMeshes ()
+{
+  WorkerPool pool;
+  for (unsigned int i = 0; i < renderers_.size (); ++i)
+    renderers_[i]->loadPendingLinks (&pool);
+  ROS_INFO ("all meshes loaded");
+}
+
+// cancels and joins the background loader, renderers_ may change afterwards
+void RealtimeURDFFilter::stopMeshLoader ()
+{
+  for (unsigned int i = 0; i < renderers_.size (); ++i)
+    renderers_[i]->cancelPendingLinks ();
+  if (mesh_loader_.joinable ())
+    mesh_loader_.join ();
+}
+
+// warms the AssetCache with the parsed model i, called on the loader threads
+void RealtimeURDFFilter::parseModelJob (const std::vector<std::pair<std::string, std::string> > *models, unsigned int i)
+{
+  if (!AssetCache::instance ().getCompiledModel ((*models)[i].first))
+    AssetCache::instance ().getModel ((*models)[i].first);
+}
+
+// the distinct visual mesh files of all models that are not in a scene bundle
+void RealtimeURDFFilter::collectMeshes (const std::vector<std::pair<std::string, std::string> > &models,
+                                        std::vector<std::string> &meshes)
+{
+  std::set<std::string> files;
+  AssetCache &assets = AssetCache::instance ();
+  for (unsigned int i = 0; i < models.size (); ++i)
+  {
+    if (assets.getCompiledModel (models[i].first))
+      continue;
+    boost::shared_ptr<const urdf::Model> model = assets.getModel (models[i].first);
+    if (!model)
+      continue;
+
+    std::vector<boost::shared_ptr<urdf::Link> > links;
+    model->getLinks (links);
+    for (unsigned int l = 0; l < links.size (); ++l)
+    {
+      const urdf::Link &link = *links[l];
+      if (link.visual && link.visual->geometry && link.visual->geometry->type == urdf::Geometry::MESH)
+        files.insert (static_cast<const urdf::Mesh&> (*link.visual->geometry).filename);
+    }
+  }
+  meshes.assign (files.begin (), files.end ());
+}
+
+// imports mesh i into the AssetCache, a WorkerPool job of loadModels ()
+void RealtimeURDFFilter::importMeshJob (const std::vector<std::string> *meshes, unsigned int i)
+{
+  RenderableMesh mesh ((*meshes)[i]);
+}
+
+// reads URDF model descriptions and tf prefixes from the "models" parameter,
+// and the optional joint state topic of every model (by tf prefix)
+void RealtimeURDFFilter::readModelParameters (std::vector<std::pair<std::string, std::string> > &models,
+                                              std::map<std::string, std::string> &joint_state_topics)
 {
   XmlRpc::XmlRpcValue v;
-  nh_.getParam ("models", v);
+  nh_->getParam ("models", v);
   
   if (v.getType () == XmlRpc::XmlRpcValue::TypeArray)
   {
@@ -130,12 +469,12 @@ void RealtimeURDFFilter::loadModels ()
       // read URDF model
       std::string content;
 
-      if (!nh_.getParam(description_param, content))
+      if (!nh_->getParam(description_param, content))
       {
         std::string loc;
-        if (nh_.searchParam(description_param, loc))
+        if (nh_->searchParam(description_param, loc))
         {
-          nh_.getParam(loc, content);
+          nh_->getParam(loc, content);
         }
         else
         {
@@ -153,7 +492,9 @@ void RealtimeURDFFilter::loadModels ()
 
       // finally, set the model description so we can later parse it.
       ROS_INFO ("Loading URDF model: %s", description_param.c_str ());
-      renderers_.push_back (new URDFRenderer (content, tf_prefix, cam_frame_, fixed_frame_, tf_));
+      models.push_back (std::make_pair (content, tf_prefix));
+      if (elem.hasMember ("joint_states"))
+        joint_state_topics[tf_prefix] = (std::string) elem["joint_states"];
     }
   }
   else
@@ -162,15 +503,24 @@ void RealtimeURDFFilter::loadModels ()
   }
 }
 
-// helper function to get current time
-double RealtimeURDFFilter::getTime ()
+void RealtimeURDFFilter::filter (unsigned char* buffer, double* glTf, int width, int height, ros::Time timestamp,
+                                 int step)
+{
+  input_16u_ = false;
+  filterImage (buffer, glTf, width, height, timestamp, step > 0 ? step : width * sizeof(GLfloat));
+}
+
+// raw millimeters, half the upload of filter (unsigned char*, ...)
+void RealtimeURDFFilter::filter (const unsigned short* buffer, double* glTf, int width, int height,
+                                 ros::Time timestamp, int step)
 {
-  timeval current_time;
-  gettimeofday (&current_time, NULL);
-  return (current_time.tv_sec + 1e-6 * current_time.tv_usec);
+  input_16u_ = true;
+  filterImage ((const unsigned char*) buffer, glTf, width, height, timestamp,
+               step > 0 ? step : width * sizeof(GLushort));
 }
 
-void RealtimeURDFFilter::filter (unsigned char* buffer, double* glTf, int width, int height, ros::Time timestamp)
+void RealtimeURDFFilter::filterImage (const unsigned char* buffer, double* glTf, int width, int height,
+                                      ros::Time timestamp, int step)
 {
   if (width_ != width || height_ != height)
   {
@@ -180,43 +530,161 @@ void RealtimeURDFFilter::filter (unsigned char* buffer, double* glTf, int width,
     initGL ();
   }
 
-  if (mask_pub_.getNumSubscribers() > 0)
-    need_mask_ = true;
-  else
-    need_mask_ = false;
+  need_mask_ = force_mask_output_ || mask_pub_.getNumSubscribers() > 0;
+  need_depth_ = force_depth_output_ || depth_pub_.getNumSubscribers() > 0;
+
+  ScopedStageTimer total_timer (metrics_, "total");
 
-  // Timing
-  static unsigned count = 0;
-  static double last = getTime ();
-  double now = getTime ();
+  // the GPU takes the rows with any stride that is a whole number of pixels,
+  // the CPU consumers index one continuous image
+  const unsigned char* packed = buffer;
+  int pixel_size = input_16u_ ? sizeof(GLushort) : sizeof(GLfloat);
+  int packed_step = width_ * pixel_size;
+  if (step != packed_step && (cpu_render_ || sparse_readback_ || step % pixel_size != 0))
+  {
+    ScopedStageTimer repack_timer (metrics_, "repack");
+    packed = bufferFromDepthImage (cv::Mat (height_, width_, input_16u_ ? CV_16UC1 : CV_32FC1,
+                                            (void*) buffer, step));
+    step = packed_step;
+  }
 
-  if (++count == 30 || (now - last) > 5)
+  if (cpu_render_)
   {
-    std::cout << "Average framerate: " << std::setprecision(3) << double(count)/double(now - last) << " Hz" << std::endl;
-    count = 0;
-    last = now;
+    // the software rasterizer compares meters
+    const float* depth = (const float*) packed;
+    if (input_16u_)
+    {
+      ScopedStageTimer repack_timer (metrics_, "repack");
+      const GLushort* depth_16u = (const GLushort*) packed;
+      cpu_depth_.resize (width_ * height_);
+      for (int i = 0; i < width_ * height_; ++i)
+        cpu_depth_[i] = millimetersToMeters (depth_16u[i]);
+      depth = &cpu_depth_[0];
+    }
+    bool rendered;
+    {
+      ScopedStageTimer render_timer (metrics_, "render");
+      rendered = renderCPU (depth, glTf);
+    }
+    if (rendered)
+    {
+      ScopedStageTimer publish_timer (metrics_, "publish");
+      publishResults (timestamp, need_depth_, need_mask_);
+    }
+    total_timer.stop ();
+    ++frames_since_diagnostics_;
+    publishDiagnostics ();
+    return;
   }
 
-  // get depth_image into OpenGL texture buffer
-  int size_in_bytes = width_ * height_ * sizeof(float);
-  textureBufferFromDepthBuffer (buffer, size_in_bytes);
+  // initGL failed, there is no context to render with
+  if (!fbo_initialized_)
+    return;
+
+  // get depth_image into OpenGL texture
+  {
+    ScopedStageTimer upload_timer (metrics_, "upload");
+    textureFromDepthBuffer (packed, step, input_16u_ ? GL_R16UI : GL_R32F);
+  }
 
   // render everything
-  render (glTf);
+  bool rendered;
+  {
+    ScopedStageTimer render_timer (metrics_, "render");
+    rendered = render (glTf);
+  }
+
+  // the GPU reads the current upload slot until here, fence it so we do not
+  // overwrite it before the rendering has finished
+  upload_fence_[upload_slot_] = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  // get the results back from the GPU. a frame that was not rendered is not
+  // read back, the deferred readback then collects its previous frame later
+  bool have_results = rendered;
+  bool has_depth = need_depth_;
+  bool has_mask = need_mask_;
+  {
+    ScopedStageTimer readback_timer (metrics_, "readback");
+    if (deferred_readback_)
+    {
+      if (rendered)
+        startReadback (timestamp);
+      have_results = finishReadback (timestamp, has_depth, has_mask);
+    }
+    else if (rendered && sparse_readback_)
+      readbackSparse (packed);
+    else if (rendered)
+      readback ();
+  }
+
+  if (have_results)
+  {
+    ScopedStageTimer publish_timer (metrics_, "publish");
+    publishResults (timestamp, has_depth, has_mask);
+  }
+
+  total_timer.stop ();
+  ++frames_since_diagnostics_;
+  publishDiagnostics ();
+}
+
+// publish latency percentiles on /diagnostics
+void RealtimeURDFFilter::publishDiagnostics ()
+{
+  ros::WallTime now = ros::WallTime::now ();
+  double elapsed = (now - last_diagnostics_).toSec ();
+  if (elapsed < diagnostics_period_)
+    return;
+
+  double framerate = frames_since_diagnostics_ / elapsed;
+  metrics_.setCounter ("framerate [Hz]", framerate);
+  frames_since_diagnostics_ = 0;
+  last_diagnostics_ = now;
 
-  // publish processed depth image and image mask
-  if (depth_pub_.getNumSubscribers() > 0)
+  if (diagnostics_pub_.getNumSubscribers () == 0)
+    return;
+
+  diagnostic_msgs::DiagnosticStatus status;
+  status.name = ros::this_node::getName () + ": latency";
+  status.hardware_id = context_ ? context_->name () : (cpu_render_ ? "cpu" : "");
+  status.level = diagnostic_msgs::DiagnosticStatus::OK;
+  std::ostringstream ss;
+  ss << std::setprecision(3) << framerate << " Hz";
+  status.message = ss.str ();
+  metrics_.toDiagnostics (status);
+
+  diagnostic_msgs::DiagnosticArray msg;
+  msg.header.stamp = ros::Time::now ();
+  msg.status.push_back (status);
+  diagnostics_pub_.publish (msg);
+}
+
+// publish processed depth image and image mask
+void RealtimeURDFFilter::publishResults (ros::Time timestamp, bool has_depth, bool has_mask)
+{
+  if (has_depth && depth_pub_.getNumSubscribers() > 0)
   {
-    cv::Mat masked_depth_image (height_, width_, CV_32FC1, masked_depth_);
     cv_bridge::CvImage out_masked_depth;
     out_masked_depth.header.frame_id = cam_frame_;
     out_masked_depth.header.stamp = timestamp;
-    out_masked_depth.encoding = "32FC1";
-    out_masked_depth.image = masked_depth_image;
+    if (output_16u_)
+    {
+      // the cpu backend and the gui filter in meters
+      if (!readback_16u_)
+        for (int i = 0; i < width_ * height_; ++i)
+          masked_depth_16u_[i] = metersToMillimeters (masked_depth_[i]);
+      out_masked_depth.encoding = "16UC1";
+      out_masked_depth.image = cv::Mat (height_, width_, CV_16UC1, masked_depth_16u_);
+    }
+    else
+    {
+      out_masked_depth.encoding = "32FC1";
+      out_masked_depth.image = cv::Mat (height_, width_, CV_32FC1, masked_depth_);
+    }
     depth_pub_.publish (out_masked_depth.toImageMsg ());
   }
 
-  if (mask_pub_.getNumSubscribers() > 0)
+  if (has_mask && mask_pub_.getNumSubscribers() > 0)
   {
     cv::Mat mask_image (height_, width_, CV_8UC1, mask_);
 
@@ -234,114 +702,378 @@ void RealtimeURDFFilter::filter_callback
      (const sensor_msgs::ImageConstPtr& ros_depth_image,
       const sensor_msgs::CameraInfo::ConstPtr& camera_info)
 {
-  // convert to OpenCV cv::Mat
+  // convert to OpenCV cv::Mat. raw 16 bit millimeters (Kinect / OpenNI) are
+  // shared as they are and converted on the GPU
+  ScopedStageTimer convert_timer (metrics_, "convert");
+  bool raw_16u = ros_depth_image->encoding == sensor_msgs::image_encodings::TYPE_16UC1;
   cv_bridge::CvImageConstPtr orig_depth_img;
   try
   {
-    orig_depth_img = cv_bridge::toCvShare (ros_depth_image, sensor_msgs::image_encodings::TYPE_32FC1);
+    orig_depth_img = cv_bridge::toCvShare (ros_depth_image, raw_16u ? sensor_msgs::image_encodings::TYPE_16UC1
+                                                                     : sensor_msgs::image_encodings::TYPE_32FC1);
   }
   catch (cv_bridge::Exception& e)
   {
     ROS_ERROR("cv_bridge Exception: %s", e.what());
     return;
   }
-  cv::Mat1f depth_image = orig_depth_img->image;
+  const cv::Mat &depth_image = orig_depth_img->image;
 
-  unsigned char *buffer = bufferFromDepthImage (depth_image);
   double glTf[16];
   getProjectionMatrix (camera_info, glTf);
+  convert_timer.stop ();
 
-  filter (buffer, glTf, depth_image.cols, depth_image.rows, ros_depth_image->header.stamp);
+  // rows are passed with their stride, padded images are not repacked
+  if (raw_16u)
+    filter ((const unsigned short*) depth_image.data, glTf, depth_image.cols, depth_image.rows,
+            ros_depth_image->header.stamp, int (depth_image.step));
+  else
+    filter (depth_image.data, glTf, depth_image.cols, depth_image.rows, ros_depth_image->header.stamp,
+            int (depth_image.step));
 }
 
-void RealtimeURDFFilter::textureBufferFromDepthBuffer (unsigned char* buffer, int size_in_bytes)
+void RealtimeURDFFilter::textureFromDepthBuffer (const unsigned char* buffer, int step, GLenum format)
 {
-  // check if we already have a PBO and Texture Buffer
-  if (depth_image_pbo_ == GL_INVALID_VALUE)
+  // the last row ends after its pixels, the padding behind it need not exist
+  int pixel_size = (format == GL_R16UI) ? sizeof(GLushort) : sizeof(GLfloat);
+  int size_in_bytes = step * (height_ - 1) + width_ * pixel_size;
+
+  // check if we already have PBOs and textures of the right size and format
+  if (upload_size_ != size_in_bytes || upload_format_ != format)
+    initUploadRing (size_in_bytes, format);
+
+  // advance to the next slot in the ring
+  upload_slot_ = (upload_slot_ + 1) % UPLOAD_RING_SIZE;
+
+  if (persistent_upload_)
   {
-    glGenBuffers (1, &depth_image_pbo_);
-    glGenTextures (1, &depth_texture_);
-  }
+    // wait until the GPU has finished reading this slot (UPLOAD_RING_SIZE frames ago)
+    GLsync &fence = upload_fence_[upload_slot_];
+    if (fence)
+    {
+      GLenum status;
+      do
+        status = glClientWaitSync (fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+      while (status == GL_TIMEOUT_EXPIRED);
+      glDeleteSync (fence);
+      fence = 0;
+    }
 
-  glBindBuffer (GL_ARRAY_BUFFER, depth_image_pbo_);
+    // buffer is mapped coherently, so a plain copy is all we need
+    memcpy (upload_ptr_[upload_slot_], buffer, size_in_bytes);
+    glBindBuffer (GL_PIXEL_UNPACK_BUFFER, depth_image_pbo_[upload_slot_]);
+  }
+  else
+  {
+    if (upload_fence_[upload_slot_])
+    {
+      glDeleteSync (upload_fence_[upload_slot_]);
+      upload_fence_[upload_slot_] = 0;
+    }
 
-  // upload buffer data to GPU
-  glBufferData (GL_ARRAY_BUFFER, size_in_bytes, buffer, GL_DYNAMIC_DRAW);
-  glBindBuffer (GL_ARRAY_BUFFER, 0);
+    // orphan the old storage so the driver does not have to sync with the GPU
+    glBindBuffer (GL_PIXEL_UNPACK_BUFFER, depth_image_pbo_[upload_slot_]);
+    glBufferData (GL_PIXEL_UNPACK_BUFFER, size_in_bytes, NULL, GL_STREAM_DRAW);
+    glBufferSubData (GL_PIXEL_UNPACK_BUFFER, 0, size_in_bytes, buffer);
+  }
 
-  // assign PBO to Texture Buffer
-  glBindTexture(GL_TEXTURE_BUFFER, depth_texture_);
-  glTexBuffer (GL_TEXTURE_BUFFER, GL_R32F, depth_image_pbo_);
+  // unpack from the buffer into the texture of the slot, the row length and
+  // alignment describe the stride of the image rows
+  int alignment = 8;
+  while (step % alignment != 0)
+    alignment /= 2;
+  glPixelStorei (GL_UNPACK_ALIGNMENT, alignment);
+  glPixelStorei (GL_UNPACK_ROW_LENGTH, step / pixel_size);
+  glBindTexture (GL_TEXTURE_2D, depth_texture_[upload_slot_]);
+  if (format == GL_R16UI)
+    glTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, width_, height_, GL_RED_INTEGER, GL_UNSIGNED_SHORT, (GLvoid*) 0);
+  else
+    glTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, width_, height_, GL_RED, GL_FLOAT, (GLvoid*) 0);
+  glBindTexture (GL_TEXTURE_2D, 0);
+  glPixelStorei (GL_UNPACK_ROW_LENGTH, 0);
+  glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+  glBindBuffer (GL_PIXEL_UNPACK_BUFFER, 0);
 }
 
-unsigned char* RealtimeURDFFilter::bufferFromDepthImage (cv::Mat1f depth_image)
+void RealtimeURDFFilter::initUploadRing (int size_in_bytes, GLenum format)
 {
-  // Host buffer to hold depth pixel data
-  static unsigned char* buffer = 0;
+  // use persistently mapped buffers if available, orphaning otherwise
+  persistent_upload_ = false;
+#ifdef GL_ARB_buffer_storage
+  persistent_upload_ = GLEW_ARB_buffer_storage;
+  const GLbitfield map_flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+#endif
 
-  // get pixel data from cv::Mat as one continuous buffer
-  int row_size = depth_image.cols * depth_image.elemSize();
-  if (depth_image.isContinuous())
-  {
-    buffer = depth_image.data;
-  }
-  else
+  // second attempt is only taken if persistent mapping failed
+  for (int attempt = 0; attempt < 2; ++attempt)
   {
-    if (buffer == 0)
+    // free the old ring, if any
+    for (int i = 0; i < UPLOAD_RING_SIZE; ++i)
+    {
+      if (upload_fence_[i])
+        glDeleteSync (upload_fence_[i]);
+      upload_fence_[i] = 0;
+
+      if (depth_image_pbo_[i] != GL_INVALID_VALUE)
+      {
+        if (upload_ptr_[i])
+        {
+          glBindBuffer (GL_PIXEL_UNPACK_BUFFER, depth_image_pbo_[i]);
+          glUnmapBuffer (GL_PIXEL_UNPACK_BUFFER);
+        }
+        glDeleteBuffers (1, &depth_image_pbo_[i]);
+        glDeleteTextures (1, &depth_texture_[i]);
+        depth_image_pbo_[i] = GL_INVALID_VALUE;
+        depth_texture_[i] = GL_INVALID_VALUE;
+      }
+      upload_ptr_[i] = 0;
+    }
+
+    bool mapped = true;
+    for (int i = 0; i < UPLOAD_RING_SIZE; ++i)
     {
-      std::cout << "(re)allocating opengl depth buffer" << std::endl;
-      buffer = (unsigned char*) malloc (row_size * depth_image.rows);
+      glGenBuffers (1, &depth_image_pbo_[i]);
+      glGenTextures (1, &depth_texture_[i]);
+
+      glBindBuffer (GL_PIXEL_UNPACK_BUFFER, depth_image_pbo_[i]);
+#ifdef GL_ARB_buffer_storage
+      if (persistent_upload_)
+      {
+        glBufferStorage (GL_PIXEL_UNPACK_BUFFER, size_in_bytes, NULL, map_flags);
+        upload_ptr_[i] = (unsigned char*) glMapBufferRange (GL_PIXEL_UNPACK_BUFFER, 0, size_in_bytes, map_flags);
+        mapped = mapped && (upload_ptr_[i] != 0);
+      }
+      else
+#endif
+        glBufferData (GL_PIXEL_UNPACK_BUFFER, size_in_bytes, NULL, GL_STREAM_DRAW);
+
+      // 2D texture of the image size, integer textures need nearest filtering
+      glBindTexture (GL_TEXTURE_2D, depth_texture_[i]);
+      if (format == GL_R16UI)
+        glTexImage2D (GL_TEXTURE_2D, 0, format, width_, height_, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, NULL);
+      else
+        glTexImage2D (GL_TEXTURE_2D, 0, format, width_, height_, 0, GL_RED, GL_FLOAT, NULL);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     }
-    for (int i = 0; i < depth_image.rows; i++)
-      memcpy ((void*)(buffer + i * row_size), (void*) &depth_image.data[i], row_size);
+    glBindBuffer (GL_PIXEL_UNPACK_BUFFER, 0);
+    glBindTexture (GL_TEXTURE_2D, 0);
+
+    if (mapped)
+      break;
+
+    // immutable storage can not be orphaned, so start over with plain buffers
+    ROS_WARN ("could not map depth upload buffers persistently, falling back to orphaning");
+    persistent_upload_ = false;
   }
 
-  return buffer;
+  upload_size_ = size_in_bytes;
+  upload_format_ = format;
+  upload_slot_ = 0;
+  ROS_INFO ("depth upload ring: %i x %i bytes of %s, %s", UPLOAD_RING_SIZE, size_in_bytes,
+      format == GL_R16UI ? "16 bit millimeters" : "32 bit meters",
+      persistent_upload_ ? "persistently mapped" : "orphaning");
+}
+
+unsigned char* RealtimeURDFFilter::bufferFromDepthImage (cv::Mat depth_image)
+{
+  if (depth_image.isContinuous())
+    return depth_image.data;
+
+  // copy the rows one after another, without their padding
+  int row_size = depth_image.cols * depth_image.elemSize();
+  packed_depth_.resize (row_size * depth_image.rows);
+  for (int i = 0; i < depth_image.rows; i++)
+    memcpy (&packed_depth_[i * row_size], depth_image.ptr (i), row_size);
+
+  return &packed_depth_[0];
 }
 
 // set up OpenGL stuff
 void RealtimeURDFFilter::initGL ()
 {
+  // the software rasterizer needs no OpenGL at all
+  if (cpu_render_)
+  {
+    if (!rasterizer_)
+      rasterizer_ = new SoftwareRasterizer (cpu_render_threads_);
+    rasterizer_->resize (width_, height_);
+    show_gui_ = false;
+    readback_16u_ = false;
+
+    loadModels ();
+    free (masked_depth_);
+    free (mask_);
+    free (masked_depth_16u_);
+    masked_depth_ = (GLfloat*) malloc(width_ * height_ * sizeof(GLfloat));
+    mask_ = (GLubyte*) malloc(width_ * height_ * sizeof(GLubyte));
+    masked_depth_16u_ = (GLushort*) malloc(width_ * height_ * sizeof(GLushort));
+    return;
+  }
+
   static bool gl_initialized = false;
-  //TODO: change this to use an offscreen pbuffer, so no window is necessary
   if (!gl_initialized)
   {
-    glutInit (&argc_, argv_);
-
-    // the window will show 3x2 grid of images
-    glutInitWindowSize (960, 480);
-    glutInitDisplayMode ( GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH | GLUT_STENCIL);
-    glutCreateWindow ("Realtime URDF Filter Debug Window");
-
-    gl_initialized = true;
-    if (!show_gui_)
+    context_ = ContextBackend::create (context_backend_, width_, height_, show_gui_, argc_, argv_);
+    if (!context_)
     {
-        glutHideWindow ();
+      ROS_FATAL ("could not create OpenGL context with backend %s", context_backend_.c_str ());
+      ros::shutdown ();
+      return;
     }
+    gl_initialized = true;
+
+    // without a window, there is nothing to show the gui in
+    show_gui_ = show_gui_ && context_->hasWindow ();
   }
 
-  // initialize glew library
+  // initialize glew library. without glewExperimental, GLEW skips entry
+  // points whose extension string it can not find, e.g. in core contexts
+  glewExperimental = GL_TRUE;
   GLenum err = glewInit();
   if (GLEW_OK != err)
   {
-    std::cout << "ERROR: could not initialize GLEW!" << std::endl;
+    ROS_FATAL ("could not initialize GLEW with the %s context: %s", context_backend_.c_str (),
+               (const char*) glewGetErrorString (err));
+    ros::shutdown ();
+    return;
+  }
+
+  // all shaders are GLSL 3.30
+  if (!GLEW_VERSION_3_3)
+  {
+    ROS_FATAL ("the %s context provides OpenGL %s, at least 3.3 is needed", context_backend_.c_str (),
+               (const char*) glGetString (GL_VERSION));
+    ros::shutdown ();
+    return;
+  }
+
+  // marking tiles needs image stores in the fragment shader
+  if (sparse_readback_)
+  {
+    bool image_store = false;
+#ifdef GL_ARB_shader_image_load_store
+    image_store = GLEW_ARB_shader_image_load_store;
+#endif
+    if (!image_store)
+    {
+      ROS_WARN ("sparse readback needs GL_ARB_shader_image_load_store, using 'blocking'");
+      sparse_readback_ = false;
+    }
   }
 
+  // the gui shows the filtered depth as a float texture, so 16 bit output is
+  // converted from it when publishing
+  readback_16u_ = output_16u_ && !show_gui_;
+
+  // the upload textures have the image size, they are recreated with the
+  // next frame
+  upload_size_ = 0;
+
   // set up FBO and load URDF models + meshes onto GPU
   initFrameBufferObject ();
+  initDrawBuffers ();
+  if (sparse_readback_)
+    initTiles ();
+  if (static_layer_)
+    initStaticLayer ();
   loadModels ();
   std::cout << " --- Initialization done. ---" << std::endl;
+  free (masked_depth_);
+  free (mask_);
+  free (masked_depth_16u_);
   masked_depth_ = (GLfloat*) malloc(width_ * height_ * sizeof(GLfloat));
   mask_ = (GLubyte*) malloc(width_ * height_ * sizeof(GLubyte));
+  masked_depth_16u_ = (GLushort*) malloc(width_ * height_ * sizeof(GLushort));
+}
+
+// set up the camera uniform buffer and the vertex buffer of the screen quad
+void RealtimeURDFFilter::initDrawBuffers ()
+{
+  if (camera_ubo_ == GL_INVALID_VALUE)
+  {
+    // projection and view matrix
+    glGenBuffers (1, &camera_ubo_);
+    glBindBuffer (GL_UNIFORM_BUFFER, camera_ubo_);
+    glBufferData (GL_UNIFORM_BUFFER, 32 * sizeof(GLfloat), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer (GL_UNIFORM_BUFFER, 0);
+
+    // unit square for screen aligned quads (compare pass, gui)
+    const GLfloat quad[] = {0.0, 0.0,  1.0, 0.0,  0.0, 1.0,  1.0, 1.0};
+    glGenVertexArrays (1, &quad_vao_);
+    glBindVertexArray (quad_vao_);
+    glGenBuffers (1, &quad_vbo_);
+    glBindBuffer (GL_ARRAY_BUFFER, quad_vbo_);
+    glBufferData (GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+    glEnableVertexAttribArray (0);
+    glVertexAttribPointer (0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glBindVertexArray (0);
+    glBindBuffer (GL_ARRAY_BUFFER, 0);
+  }
+}
+
+// one 32 bit texel per image tile, set to non-zero by the filter shader
+void RealtimeURDFFilter::initTiles ()
+{
+  tiles_x_ = (width_ + TILE_SIZE - 1) / TILE_SIZE;
+  tiles_y_ = (height_ + TILE_SIZE - 1) / TILE_SIZE;
+  tiles_.assign (tiles_x_ * tiles_y_, 0);
+
+  if (tile_texture_ == GL_INVALID_VALUE)
+    glGenTextures (1, &tile_texture_);
+  glBindTexture (GL_TEXTURE_2D, tile_texture_);
+  glTexImage2D (GL_TEXTURE_2D, 0, GL_R32UI, tiles_x_, tiles_y_, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &tiles_[0]);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture (GL_TEXTURE_2D, 0);
+}
+
+// depth texture with the size and format of the one of fbo_, and an FBO
+// without color attachments to blit into it
+void RealtimeURDFFilter::initStaticLayer ()
+{
+  static_layer_valid_ = false;
+
+  GLenum target = fbo_->getTextureTarget ();
+  if (static_depth_texture_ == GL_INVALID_VALUE)
+    glGenTextures (1, &static_depth_texture_);
+  glBindTexture (target, static_depth_texture_);
+  glTexImage2D (target, 0, GL_DEPTH_COMPONENT24, width_, height_, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+  glTexParameteri (target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri (target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture (target, 0);
+
+  if (static_fbo_ == GL_INVALID_VALUE)
+    glGenFramebuffers (1, &static_fbo_);
+  glBindFramebuffer (GL_FRAMEBUFFER, static_fbo_);
+  glFramebufferTexture2D (GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, target, static_depth_texture_, 0);
+  glDrawBuffer (GL_NONE);
+  glReadBuffer (GL_NONE);
+
+  GLuint status = glCheckFramebufferStatus (GL_FRAMEBUFFER);
+  glBindFramebuffer (GL_FRAMEBUFFER, 0);
+  if (status != GL_FRAMEBUFFER_COMPLETE)
+  {
+    ROS_WARN ("static layer FBO incomplete (%i), rendering all models every frame", status);
+    static_layer_ = false;
+  }
 }
 
 // set up FBO
 void RealtimeURDFFilter::initFrameBufferObject ()
 {
-  fbo_ = new FramebufferObject ("rgba=4x32t depth=24t stencil=8t");
+  // filtered depth (meters, or millimeters for 16 bit output) and mask are
+  // all we read back, the sensor depth image and the normals are only drawn
+  // for the gui
+  std::string mode = readback_16u_ ? "c0=r16ui c1=r8 depth=24t" : "c0=r32f c1=r8 depth=24t";
+  if (show_gui_)
+    mode += " c2=r32f c3=rgba8";
+  delete fbo_;
+  fbo_ = new FramebufferObject (mode.c_str ());
 
   fbo_->initialize (width_, height_);
   fbo_initialized_ = true;
+  virtual_depth_valid_ = false;
 
   GLenum err = glGetError();
   if(err != GL_NO_ERROR)
@@ -408,300 +1140,774 @@ void RealtimeURDFFilter::getProjectionMatrix (const sensor_msgs::CameraInfo::Con
   glTf[11]= -1;
 }
 
-void RealtimeURDFFilter::render (const double* camera_projection_matrix)
+// get transformation from camera to "fixed frame", and all link transforms
+bool RealtimeURDFFilter::updateTransforms (tf::StampedTransform &camera_to_fixed)
 {
-  if (!fbo_initialized_)
-    return;
-
-  static const GLenum buffers[] = {
-    GL_COLOR_ATTACHMENT0_EXT,
-    GL_COLOR_ATTACHMENT1_EXT,
-    GL_COLOR_ATTACHMENT2_EXT,
-    GL_COLOR_ATTACHMENT3_EXT
-  };
-
-  // get transformation from camera to "fixed frame"
-  tf::StampedTransform t;
+  ScopedStageTimer tf_timer (metrics_, "tf");
   try
   {
-    tf_.lookupTransform (cam_frame_, fixed_frame_, ros::Time (), t);
+    tf_->lookupTransform (cam_frame_, fixed_frame_, ros::Time (), camera_to_fixed);
   }
   catch (tf::TransformException ex)
   {
     ROS_ERROR("%s",ex.what());
-    return;
+    return false;
   }
 
-  GLenum err = glGetError();
-  if(err != GL_NO_ERROR)
-    printf("OpenGL ERROR at beginning of rendering: %s\n", gluErrorString(err));
+  // links whose meshes finished loading replace their proxies
+  bool swapped = false;
+  std::vector<URDFRenderer*>::const_iterator r;
+  for (r = renderers_.begin (); r != renderers_.end (); r++)
+    swapped |= (*r)->swapLoadedLinks ();
+  if (swapped)
+    buildScene ();
 
-  glPushAttrib(GL_ALL_ATTRIB_BITS);
-  glEnable(GL_NORMALIZE);
+  for (r = renderers_.begin (); r != renderers_.end (); r++)
+    (*r)->update_link_transforms ();
+  return true;
+}
 
-  // render into FBO
-  fbo_->beginCapture();
+// transformation from "fixed frame" to OpenGL eye coordinates
+tf::Transform RealtimeURDFFilter::getViewTransform (const tf::Transform &camera_to_fixed)
+{
+  // kinect has x right, y down, z into image. OpenGL looks down -z, so
+  // rotate by 180 degrees around y, like gluLookAt (0,0,0, 0,0,1, 0,1,0)
+  tf::Transform view (tf::Quaternion (0, 1, 0, 0), tf::Vector3 (0, 0, 0));
 
-  // create shader programs
-  static ShaderWrapper shader = ShaderWrapper::fromFiles
-    ("package://realtime_urdf_filter/include/shaders/urdf_filter.vert", 
-     "package://realtime_urdf_filter/include/shaders/urdf_filter.frag");
+  // apply user-defined camera offset transformation (launch file)
+  view *= tf::Transform (camera_offset_q_, camera_offset_t_).inverse ();
 
-  err = glGetError();
-  if(err != GL_NO_ERROR)
-    printf("OpenGL ERROR compiling shaders: %s\n", gluErrorString(err));
-  
-  // enable shader for this frame
-  shader ();
+  // apply camera to "fixed frame" transform (world coordinates)
+  view *= camera_to_fixed;
+  return view;
+}
 
-  glDrawBuffers(sizeof(buffers) / sizeof(GLenum), buffers);
+// a renderable is static once its link_to_fixed did not change for
+// STATIC_LAYER_FRAMES frames. any change of the static set or of the camera
+// makes the static layer stale
+bool RealtimeURDFFilter::updateStaticLayer (const tf::Transform &view, const double* camera_projection_matrix)
+{
+  if (!static_layer_ || static_fbo_ == GL_INVALID_VALUE)
+    return false;
 
-  // clear the buffers
-  glClearColor(0.0, 0.0, 0.0, 1.0);
-  glClearStencil(0x0);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+  unsigned int num_static = 0;
+  std::vector<URDFRenderer*>::const_iterator r;
+  for (r = renderers_.begin (); r != renderers_.end (); r++)
+  {
+    const std::vector<boost::shared_ptr<Renderable> > &renderables = (*r)->getRenderables ();
+    for (unsigned int i = 0; i < renderables.size (); ++i)
+    {
+      Renderable &renderable = *renderables[i];
+      if (renderable.link_to_fixed == renderable.previous_link_to_fixed)
+      {
+        if (renderable.unchanged_frames < STATIC_LAYER_FRAMES)
+          ++renderable.unchanged_frames;
+      }
+      else
+      {
+        renderable.previous_link_to_fixed = renderable.link_to_fixed;
+        renderable.unchanged_frames = 0;
+      }
 
-  glEnable(GL_DEPTH_TEST);
-  glDisable(GL_TEXTURE_2D);
-  fbo_->disableTextureTarget();
+      bool is_static = renderable.unchanged_frames >= STATIC_LAYER_FRAMES;
+      if (is_static != renderable.is_static)
+      {
+        renderable.is_static = is_static;
+        static_layer_valid_ = false;
+      }
+      if (is_static)
+        ++num_static;
+    }
+  }
+  metrics_.setCounter ("static instances", num_static);
 
-  // setup camera projection
-  glMatrixMode (GL_PROJECTION);
-  glLoadIdentity();
+  if (!(view == static_view_))
+  {
+    static_view_ = view;
+    static_layer_valid_ = false;
+  }
+  for (int i = 0; i < 16; ++i)
+    if (camera_projection_matrix[i] != static_projection_[i])
+    {
+      static_projection_[i] = camera_projection_matrix[i];
+      static_layer_valid_ = false;
+    }
+  return true;
+}
 
-  // load camera projection matrix into OpenGL camera matrix
-  glMultMatrixd(camera_projection_matrix);
+// keeps the depth (and the tiles) of the static renderables drawn into fbo_
+void RealtimeURDFFilter::saveStaticLayer ()
+{
+  copyDepth (fbo_->getFramebufferID (), static_fbo_);
+  if (sparse_readback_)
+  {
+#ifdef GL_ARB_shader_image_load_store
+    glMemoryBarrier (GL_TEXTURE_UPDATE_BARRIER_BIT);
+#endif
+    static_tiles_.resize (tiles_.size ());
+    glBindTexture (GL_TEXTURE_2D, tile_texture_);
+    glGetTexImage (GL_TEXTURE_2D, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &static_tiles_[0]);
+    glBindTexture (GL_TEXTURE_2D, 0);
+  }
+  static_layer_valid_ = true;
+  metrics_.incrementCounter ("static layer renders");
+}
 
-  // setup camera position
-  glMatrixMode(GL_MODELVIEW);
-  glLoadIdentity();
+// depth only blit between two framebuffers of the image size
+void RealtimeURDFFilter::copyDepth (GLuint src, GLuint dst)
+{
+  glBindFramebuffer (GL_READ_FRAMEBUFFER, src);
+  glBindFramebuffer (GL_DRAW_FRAMEBUFFER, dst);
+  glBlitFramebuffer (0, 0, width_, height_, 0, 0, width_, height_, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer (GL_FRAMEBUFFER, fbo_->getFramebufferID ());
+}
 
-  // kinect has x right, y down, z into image
-  gluLookAt (0,0,0, 0,0,1, 0,1,0);
-  
-  // draw background quad behind everything (just before the far plane)
-  // otherwise, the shader only sees kinect points where he rendered stuff
-  glBegin(GL_QUADS);
-    glVertex3f(-10.0, -10.0, far_plane_*0.99);
-    glVertex3f( 10.0, -10.0, far_plane_*0.99);
-    glVertex3f( 10.0,  10.0, far_plane_*0.99);
-    glVertex3f(-10.0,  10.0, far_plane_*0.99);
-  glEnd();
- 
-  // apply user-defined camera offset transformation (launch file)
-  tf::Transform transform (camera_offset_q_, camera_offset_t_);
-  btScalar glTf[16];
-  transform.inverse().getOpenGLMatrix(glTf);
-  glMultMatrixd((GLdouble*)glTf);
+// compares camera and links to the transforms of the last geometry pass
+bool RealtimeURDFFilter::canReuseVirtualDepth (const tf::Transform &view, const double* camera_projection_matrix,
+                                               unsigned outputs)
+{
+  if (temporal_reuse_epsilon_ < 0.0)
+    return false;
 
-  // apply camera to "fixed frame" transform (world coordinates)
-  t.getOpenGLMatrix(glTf);
-  glMultMatrixd((GLdouble*)glTf);
-  
-  // set up stencil buffer etc.
-  // the background quad is not in the stencil buffer
-  glEnable(GL_STENCIL_TEST);
-  glStencilFunc(GL_ALWAYS, 0x1, 0x1);
-  glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+  bool reuse = virtual_depth_valid_ && (outputs & OUTPUT_DEBUG) == (virtual_depth_outputs_ & OUTPUT_DEBUG)
+               && isNearlyEqual (view, virtual_depth_view_, temporal_reuse_epsilon_);
+  for (int i = 0; i < 16 && reuse; ++i)
+    reuse = camera_projection_matrix[i] == virtual_depth_projection_[i];
 
-  // make texture with depth image available in shader
-  glActiveTexture (GL_TEXTURE0);
-  GLuint depth_texture_id = 0;
-  shader.SetUniformVal1i (std::string("depth_texture"), depth_texture_id);
-  shader.SetUniformVal1i (std::string("width"), int(width_));
-  shader.SetUniformVal1i (std::string("height"), int(height_));
-  shader.SetUniformVal1f (std::string("z_far"), far_plane_);
-  shader.SetUniformVal1f (std::string("z_near"), near_plane_);
-  shader.SetUniformVal1f (std::string("max_diff"), float(depth_distance_threshold_));
-  shader.SetUniformVal1f (std::string("replace_value"), float(filter_replace_value_));
-  glBindTexture (GL_TEXTURE_BUFFER, depth_texture_);
-
-  // render every renderable / urdf model
   std::vector<URDFRenderer*>::const_iterator r;
+  for (r = renderers_.begin (); r != renderers_.end () && reuse; r++)
+  {
+    const std::vector<boost::shared_ptr<Renderable> > &renderables = (*r)->getRenderables ();
+    for (unsigned int i = 0; i < renderables.size () && reuse; ++i)
+      reuse = isNearlyEqual (renderables[i]->link_to_fixed, renderables[i]->rendered_link_to_fixed,
+                             temporal_reuse_epsilon_);
+  }
+  if (reuse)
+    return true;
+
+  // the geometry pass runs, remember what it draws
+  virtual_depth_valid_ = true;
+  virtual_depth_outputs_ = outputs;
+  virtual_depth_view_ = view;
+  for (int i = 0; i < 16; ++i)
+    virtual_depth_projection_[i] = camera_projection_matrix[i];
   for (r = renderers_.begin (); r != renderers_.end (); r++)
-    (*r)->render ();
+  {
+    const std::vector<boost::shared_ptr<Renderable> > &renderables = (*r)->getRenderables ();
+    for (unsigned int i = 0; i < renderables.size (); ++i)
+      renderables[i]->rendered_link_to_fixed = renderables[i]->link_to_fixed;
+  }
+  return false;
+}
 
-  // disable shader
-  glUseProgram((GLuint)NULL);
-  
-  fbo_->endCapture();
-  glPopAttrib();
+// element-wise comparison of translation and rotation matrix
+bool RealtimeURDFFilter::isNearlyEqual (const tf::Transform &a, const tf::Transform &b, double epsilon)
+{
+  for (int i = 0; i < 3; ++i)
+  {
+    if (std::fabs (a.getOrigin ()[i] - b.getOrigin ()[i]) > epsilon)
+      return false;
+    for (int j = 0; j < 3; ++j)
+      if (std::fabs (a.getBasis ()[i][j] - b.getBasis ()[i][j]) > epsilon)
+        return false;
+  }
+  return true;
+}
+
+// sensor convention for 16 bit depth images
+float RealtimeURDFFilter::millimetersToMeters (GLushort depth)
+{
+  if (depth == 0)
+    return std::numeric_limits<float>::quiet_NaN ();
+  return depth * 0.001f;
+}
+
+// same rounding as the OUTPUT_16U variant of depth_compare.frag
+GLushort RealtimeURDFFilter::metersToMillimeters (float depth)
+{
+  if (!(depth > 0.0f))
+    return 0;
+  return (GLushort) std::min (depth * 1000.0f + 0.5f, float(UNCOVERED_16U - 1));
+}
+
+// software rendering path, produces the same output as render () + readback ()
+bool RealtimeURDFFilter::renderCPU (const float* depth, const double* camera_projection_matrix)
+{
+  tf::StampedTransform t;
+  if (!updateTransforms (t))
+    return false;
+
+  tf::Transform view = getViewTransform (t);
+
+  rasterizer_->setProjection (camera_projection_matrix);
+  // pixels without a model are compared to a surface just before the far plane
+  rasterizer_->clear (rasterizer_->windowDepth (far_plane_ * 0.99));
+
+  btScalar glTf[16];
+  view.getOpenGLMatrix (glTf);
+  Frustum frustum (camera_projection_matrix, glTf);
+  unsigned int culled = 0;
+
+  std::vector<URDFRenderer*>::const_iterator r;
+  for (r = renderers_.begin (); r != renderers_.end (); r++)
+  {
+    const std::vector<boost::shared_ptr<Renderable> > &renderables = (*r)->getRenderables ();
+    for (unsigned int i = 0; i < renderables.size (); ++i)
+    {
+      tf::Vector3 center;
+      double radius;
+      renderables[i]->getBoundingSphere (center, radius);
+      if (!frustum.intersectsSphere (center, radius))
+      {
+        ++culled;
+        continue;
+      }
+
+      tf::Transform modelview = view * renderables[i]->link_to_fixed * renderables[i]->link_offset;
+      modelview.getOpenGLMatrix (glTf);
+      const tf::Vector3 &scale = renderables[i]->scale;
+      for (int c = 0; c < 3; ++c)
+      {
+        glTf[c] *= scale.x ();
+        glTf[4+c] *= scale.y ();
+        glTf[8+c] *= scale.z ();
+      }
+      rasterizer_->addTriangles (renderables[i]->geometry->getTriangles (), glTf);
+    }
+  }
+  metrics_.setCounter ("culled", culled);
+
+  rasterizer_->rasterize ();
+  rasterizer_->compare (depth, near_plane_, far_plane_,
+                        depth_distance_threshold_, filter_replace_value_,
+                        need_depth_ ? masked_depth_ : NULL,
+                        need_mask_ ? mask_ : NULL);
+  return true;
+}
+
+bool RealtimeURDFFilter::render (const double* camera_projection_matrix)
+{
+  if (!fbo_initialized_)
+    return false;
+
+  static const GLenum buffers[] = {
+    GL_COLOR_ATTACHMENT0_EXT + FILTERED_ATTACHMENT,
+    GL_COLOR_ATTACHMENT0_EXT + MASK_ATTACHMENT,
+    GL_COLOR_ATTACHMENT0_EXT + SENSOR_ATTACHMENT,
+    GL_COLOR_ATTACHMENT0_EXT + NORMAL_ATTACHMENT
+  };
 
-  if (need_mask_ || show_gui_)
+  // get transformation from camera to "fixed frame", and all link transforms
+  tf::StampedTransform t;
+  if (!updateTransforms (t))
+    return false;
+
+  // collect the GPU time of the frame before last and start timing this one.
+  // if that frame is still not finished, its sample is dropped rather than
+  // waited for
+  if (gpu_timer_query_[0] == GL_INVALID_VALUE)
+    glGenQueries (2, gpu_timer_query_);
+  gpu_timer_index_ = 1 - gpu_timer_index_;
+  if (gpu_timer_pending_[gpu_timer_index_])
   {
-    // use stencil buffer to draw a red / blue mask into color attachment 3
-    glPushAttrib(GL_ALL_ATTRIB_BITS);
+    GLint available = 0;
+    glGetQueryObjectiv (gpu_timer_query_[gpu_timer_index_], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available)
+    {
+      GLuint64 elapsed_ns = 0;
+      glGetQueryObjectui64v (gpu_timer_query_[gpu_timer_index_], GL_QUERY_RESULT, &elapsed_ns);
+      metrics_.addSample ("gpu", elapsed_ns * 1e-9);
+    }
+    else
+      metrics_.incrementCounter ("gpu samples dropped");
+  }
+  glBeginQuery (GL_TIME_ELAPSED, gpu_timer_query_[gpu_timer_index_]);
+  gpu_timer_pending_[gpu_timer_index_] = true;
 
-    fbo_->beginCapture();
-    glDrawBuffer(GL_COLOR_ATTACHMENT3_EXT);
+  GLenum err = glGetError();
+  if(err != GL_NO_ERROR)
+    printf("OpenGL ERROR at beginning of rendering: %s\n", gluErrorString(err));
 
-    glEnable(GL_STENCIL_TEST);
-    glStencilFunc(GL_EQUAL, 0x1, 0x1);
-    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+  // render into FBO, our own shaders write all color attachments
+  fbo_->beginCapture(false);
 
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_TEXTURE_2D);
-    fbo_->disableTextureTarget();
+  // shader variants, flags in the order of the OUTPUT_* bits. the geometry
+  // pass writes depth (and the normals for the gui), the compare pass
+  // computes everything else once per pixel
+  static const char* output_flags[] = {"OUTPUT_DEPTH", "OUTPUT_MASK", "OUTPUT_DEBUG", "INPUT_16U", "OUTPUT_16U"};
+  static const std::vector<std::string> flags (output_flags, output_flags + 5);
+  static ShaderPermutations geometry_shaders
+    ("package://realtime_urdf_filter/include/shaders/urdf_filter.vert", 
+     "package://realtime_urdf_filter/include/shaders/urdf_filter.frag", flags);
+  static ShaderPermutations compare_shaders
+    ("package://realtime_urdf_filter/include/shaders/screen_quad.vert", 
+     "package://realtime_urdf_filter/include/shaders/depth_compare.frag", flags);
 
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-    glLoadIdentity();
-    gluOrtho2D(0.0, 1.0, 0.0, 1.0);
+  // only compute the outputs somebody consumes this frame
+  unsigned outputs = (need_depth_ ? OUTPUT_DEPTH : 0) | (need_mask_ ? OUTPUT_MASK : 0);
+  if (show_gui_)
+    outputs = OUTPUT_DEPTH | OUTPUT_MASK | OUTPUT_DEBUG;
 
-    glMatrixMode(GL_MODELVIEW);	
-    glPushMatrix();
-    glLoadIdentity();
+  bool created;
+  ShaderWrapper &shader = geometry_shaders.get (outputs & OUTPUT_DEBUG, created);
+  if (created)
+    shader.BindUniformBlock ("Camera", 0);
+  unsigned formats = (input_16u_ ? INPUT_16U : 0) | (readback_16u_ ? OUTPUT_16U : 0);
+  ShaderWrapper &compare_shader = compare_shaders.get (outputs | formats, created);
+  if (created)
+    metrics_.setCounter ("shader variants", geometry_shaders.size () + compare_shaders.size ());
 
-    glColor3f(1.0, 0.0, 0.0);
+  err = glGetError();
+  if(err != GL_NO_ERROR)
+    printf("OpenGL ERROR compiling shaders: %s\n", gluErrorString(err));
 
-    glBegin(GL_QUADS);
-      glVertex2f(0.0, 0.0);
-      glVertex2f(1.0, 0.0);
-      glVertex2f(1.0, 1.0);
-      glVertex2f(0.0, 1.0);
-    glEnd();
+  // -------------------------------------------------------------------------
+  // geometry pass: depth only, except for the normals of the gui
 
-    glPopMatrix();
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
+  // camera matrices for this frame: the camera projection, and the view transform
+  tf::Transform view = getViewTransform (t);
 
-    glStencilFunc(GL_EQUAL, 0x0, 0x1);
-    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+  // temporal reuse: if neither the camera nor any link moved noticeably
+  // since the last geometry pass, its depth (and the marked tiles) are still
+  // in fbo_ and only the compare pass runs
+  bool reuse_virtual_depth = canReuseVirtualDepth (view, camera_projection_matrix, outputs);
+  if (temporal_reuse_epsilon_ >= 0.0)
+    metrics_.incrementCounter (reuse_virtual_depth ? "temporal reuse hits" : "temporal reuse misses");
 
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_TEXTURE_2D);
-    fbo_->disableTextureTarget();
+  GLenum draw_buffers[4] = {GL_NONE, GL_NONE, GL_NONE, GL_NONE};
+  if (reuse_virtual_depth)
+    metrics_.setCounter ("draw calls", 0);
+  else
+  {
+    fbo_->setDepthAttachmentEnabled (true);
+    if (outputs & OUTPUT_DEBUG)
+      draw_buffers[NORMAL_ATTACHMENT] = buffers[NORMAL_ATTACHMENT];
+    glDrawBuffers(4, draw_buffers);
+
+    // clear the buffers
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-    glLoadIdentity();
-    gluOrtho2D(0.0, 1.0, 0.0, 1.0);
+    // static layer: renderables that did not move for a while are drawn into a
+    // cached depth buffer, which is the starting point of every frame until
+    // the camera or one of them moves. the gui normals are not cached
+    bool use_static_layer = updateStaticLayer (view, camera_projection_matrix) && !(outputs & OUTPUT_DEBUG);
+    bool restore_static_layer = use_static_layer && static_layer_valid_;
+    if (restore_static_layer)
+      copyDepth (static_fbo_, fbo_->getFramebufferID ());
+
+    // sparse readback: reset the tiles, to the ones of the static layer if that
+    // is reused
+    if (sparse_readback_)
+    {
+      if (restore_static_layer)
+        tiles_ = static_tiles_;
+      else
+        std::fill (tiles_.begin (), tiles_.end (), 0);
+      glBindTexture (GL_TEXTURE_2D, tile_texture_);
+      glTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, tiles_x_, tiles_y_, GL_RED_INTEGER, GL_UNSIGNED_INT, &tiles_[0]);
+      glBindTexture (GL_TEXTURE_2D, 0);
+#ifdef GL_ARB_shader_image_load_store
+      glBindImageTexture (0, tile_texture_, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32UI);
+#endif
+    }
 
-    glMatrixMode(GL_MODELVIEW);	
-    glPushMatrix();
-    glLoadIdentity();
+    glEnable(GL_DEPTH_TEST);
 
-    glColor3f(0.0, 0.0, 1.0);
+    btScalar glTf[16];
+    GLfloat camera[32];
+    view.getOpenGLMatrix (glTf);
+    for (int i = 0; i < 16; ++i)
+    {
+      camera[i] = camera_projection_matrix[i];
+      camera[16 + i] = glTf[i];
+    }
+    glBindBuffer (GL_UNIFORM_BUFFER, camera_ubo_);
+    glBufferSubData (GL_UNIFORM_BUFFER, 0, sizeof(camera), camera);
+    glBindBuffer (GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase (GL_UNIFORM_BUFFER, 0, camera_ubo_);
+
+    // everything at once, or the static layer (if it has to be redrawn) and
+    // then the dynamic renderables on top
+    InstancedScene::Layer layers[2];
+    int num_layers = 0;
+    if (!use_static_layer)
+      layers[num_layers++] = InstancedScene::ALL_LAYERS;
+    else
+    {
+      if (!static_layer_valid_)
+        layers[num_layers++] = InstancedScene::STATIC_LAYER;
+      layers[num_layers++] = InstancedScene::DYNAMIC_LAYER;
+    }
 
-    glBegin(GL_QUADS);
-      glVertex2f(0.0, 0.0);
-      glVertex2f(1.0, 0.0);
-      glVertex2f(1.0, 1.0);
-      glVertex2f(0.0, 1.0);
-    glEnd();
+    double view_matrix[16];
+    view.getOpenGLMatrix (view_matrix);
+    Frustum frustum (camera_projection_matrix, view_matrix);
+    unsigned int draw_calls = 0, culled = 0;
+    for (int l = 0; l < num_layers; ++l)
+    {
+      shader ();
+      shader.SetUniformVal1i (std::string("mark_tiles"), sparse_readback_);
+      shader.SetUniformVal1i (std::string("tile_size"), TILE_SIZE);
+      shader.SetUniformVal1i (std::string("tiles"), 0);
 
-    glPopMatrix();
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
-    
-    fbo_->endCapture();
+      // render every renderable / urdf model of this layer inside the view
+      // frustum, in one multi draw call if possible
+      scene_.render (frustum, layers[l]);
 
-    glPopAttrib();
+      // spheres and cylinders: ray-cast in a proxy box around every instance
+      if (scene_.numImpostors () > 0)
+      {
+        static ShaderPermutations impostor_shaders
+          ("package://realtime_urdf_filter/include/shaders/impostor.vert", 
+           "package://realtime_urdf_filter/include/shaders/impostor.frag", flags);
+        ShaderWrapper &impostor_shader = impostor_shaders.get (outputs & OUTPUT_DEBUG, created);
+        if (created)
+        {
+          impostor_shader.BindUniformBlock ("Camera", 0);
+          metrics_.setCounter ("shader variants", geometry_shaders.size () + compare_shaders.size ()
+                                                  + impostor_shaders.size ());
+        }
+
+        impostor_shader ();
+        impostor_shader.SetUniformVal1i (std::string("mark_tiles"), sparse_readback_);
+        impostor_shader.SetUniformVal1i (std::string("tile_size"), TILE_SIZE);
+        impostor_shader.SetUniformVal1i (std::string("tiles"), 0);
+        impostor_shader.SetUniformVal1i (std::string("cylinder"), 0);
+        scene_.renderImpostors (Geometry::SPHERE);
+        impostor_shader.SetUniformVal1i (std::string("cylinder"), 1);
+        scene_.renderImpostors (Geometry::CYLINDER);
+      }
+      draw_calls += scene_.numDrawCalls ();
+      culled += scene_.numCulled ();
+
+      if (layers[l] == InstancedScene::STATIC_LAYER)
+        saveStaticLayer ();
+    }
+    metrics_.setCounter ("draw calls", draw_calls);
+    metrics_.setCounter ("culled", culled);
+
+#ifdef GL_ARB_shader_image_load_store
+    // tiles are read with glGetTexImage after rendering
+    if (sparse_readback_)
+      glMemoryBarrier (GL_TEXTURE_UPDATE_BARRIER_BIT);
+#endif
+  }
+
+  glBindVertexArray (0);
+  glDisable(GL_DEPTH_TEST);
+
+  // -------------------------------------------------------------------------
+  // compare pass: one full-screen quad that compares the depth of the
+  // geometry pass to the sensor depth. the depth texture is read, so it must
+  // not be attached while doing that
+
+  fbo_->setDepthAttachmentEnabled (false);
+  for (int i = 0; i < 4; ++i)
+    draw_buffers[i] = buffers[i];
+  if (!(outputs & OUTPUT_DEPTH))
+    draw_buffers[FILTERED_ATTACHMENT] = GL_NONE;
+  if (!(outputs & OUTPUT_MASK))
+    draw_buffers[MASK_ATTACHMENT] = GL_NONE;
+  if (!(outputs & OUTPUT_DEBUG))
+    draw_buffers[SENSOR_ATTACHMENT] = GL_NONE;
+  draw_buffers[NORMAL_ATTACHMENT] = GL_NONE;
+  glDrawBuffers(4, draw_buffers);
+
+  // with the sparse readback, pixels without a model are left to the CPU.
+  // they keep a marker value in the filtered image and 0 in the mask
+  if (sparse_readback_)
+  {
+    const GLfloat uncovered[] = {-std::numeric_limits<float>::infinity (), 0.0, 0.0, 1.0};
+    const GLuint uncovered_16u[] = {UNCOVERED_16U, 0, 0, 0};
+    const GLfloat no_mask[] = {0.0, 0.0, 0.0, 0.0};
+    if (readback_16u_)
+      glClearBufferuiv (GL_COLOR, FILTERED_ATTACHMENT, uncovered_16u);
+    else
+      glClearBufferfv (GL_COLOR, FILTERED_ATTACHMENT, uncovered);
+    glClearBufferfv (GL_COLOR, MASK_ATTACHMENT, no_mask);
   }
 
+  // sensor depth image on unit 0, depth of the geometry pass on unit 1
+  glActiveTexture (GL_TEXTURE0);
+  glBindTexture (GL_TEXTURE_2D, depth_texture_[upload_slot_]);
+  glActiveTexture (GL_TEXTURE1);
+  glBindTexture (fbo_->getTextureTarget(), fbo_->getDepthAttachmentID());
+
+  compare_shader ();
+  compare_shader.SetUniformVal1i (std::string("depth_texture"), 0);
+  compare_shader.SetUniformVal1i (std::string("virtual_depth_texture"), 1);
+  compare_shader.SetUniformVal1f (std::string("z_far"), far_plane_);
+  compare_shader.SetUniformVal1f (std::string("z_near"), near_plane_);
+  compare_shader.SetUniformVal1f (std::string("max_diff"), float(depth_distance_threshold_));
+  compare_shader.SetUniformVal1f (std::string("replace_value"), float(filter_replace_value_));
+  // pixels without a model are compared to a surface just before the far plane
+  compare_shader.SetUniformVal1f (std::string("background_depth"), far_plane_ * 0.99);
+  compare_shader.SetUniformVal1i (std::string("skip_background"), sparse_readback_);
+  compare_shader.SetUniformVal4f ("rect", 0.0, 0.0, 1.0, 1.0);
+
+  glBindVertexArray (quad_vao_);
+  glDrawArrays (GL_TRIANGLE_STRIP, 0, 4);
+  glBindVertexArray (0);
+
+  glBindTexture (fbo_->getTextureTarget(), 0);
+  glActiveTexture (GL_TEXTURE0);
+
+  // disable shader
+  glUseProgram((GLuint)NULL);
+  fbo_->endCapture(false);
+
   if (show_gui_)
   {
+    // shader for the gui, draws screen aligned quads
+    static ShaderWrapper quad_shader = ShaderWrapper::fromFiles
+      ("package://realtime_urdf_filter/include/shaders/screen_quad.vert", 
+       "package://realtime_urdf_filter/include/shaders/screen_quad.frag");
+
     // -----------------------------------------------------------------------
     // -----------------------------------------------------------------------
     // render all color buffer attachments into window
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-    glLoadIdentity();
-    gluOrtho2D(0.0, 1.0, 0.0, 1.0);
-
-    glMatrixMode(GL_MODELVIEW);	
-    glPushMatrix();
-    glLoadIdentity();
-
-    // draw color buffer 0
-    fbo_->bind(0);
-    glBegin(GL_QUADS);
-      glTexCoord2f(0.0, fbo_->getHeight());
-      glVertex2f(0.0, 0.5);
-      glTexCoord2f(fbo_->getWidth(), fbo_->getHeight());
-      glVertex2f(0.333, 0.5);
-      glTexCoord2f(fbo_->getWidth(), 0.0);
-      glVertex2f(0.333, 1.0);
-      glTexCoord2f(0.0, 0.0);
-      glVertex2f(0.0, 1.0);
-    glEnd();
-
-    // draw color buffer 1
-    fbo_->bind(1);
-    glBegin(GL_QUADS);
-      glTexCoord2f(0.0, fbo_->getHeight());
-      glVertex2f(0.0, 0.0);
-      glTexCoord2f(fbo_->getWidth(), fbo_->getHeight());
-      glVertex2f(0.333, 0.0);
-      glTexCoord2f(fbo_->getWidth(), 0.0);
-      glVertex2f(0.333, 0.5);
-      glTexCoord2f(0.0, 0.0);
-      glVertex2f(0.0, 0.5);
-    glEnd();
-
-    // draw color buffer 2
-    fbo_->bind(2);
-    glBegin(GL_QUADS);
-      glTexCoord2f(0.0, fbo_->getHeight());
-      glVertex2f(0.333, 0.5);
-      glTexCoord2f(fbo_->getWidth(), fbo_->getHeight());
-      glVertex2f(0.666, 0.5);
-      glTexCoord2f(fbo_->getWidth(), 0.0);
-      glVertex2f(0.666, 1.0);
-      glTexCoord2f(0.0, 0.0);
-      glVertex2f(0.333, 1.0);
-    glEnd();
-
-    // draw color buffer 3
-    fbo_->bind(3);
-    glBegin(GL_QUADS);
-      glTexCoord2f(0.0, fbo_->getHeight());
-      glVertex2f(0.333, 0.0);
-      glTexCoord2f(fbo_->getWidth(), fbo_->getHeight());
-      glVertex2f(0.666, 0.0);
-      glTexCoord2f(fbo_->getWidth(), 0.0);
-      glVertex2f(0.666, 0.5);
-      glTexCoord2f(0.0, 0.0);
-      glVertex2f(0.333, 0.5);
-    glEnd();
-
-    // draw depth buffer 
-    fbo_->bindDepth();
-    glBegin(GL_QUADS);
-      glTexCoord2f(0.0, fbo_->getHeight());
-      glVertex2f(0.666, 0.5);
-      glTexCoord2f(fbo_->getWidth(), fbo_->getHeight());
-      glVertex2f(1.0, 0.5);
-      glTexCoord2f(fbo_->getWidth(), 0.0);
-      glVertex2f(1.0, 1.0);
-      glTexCoord2f(0.0, 0.0);
-      glVertex2f(0.666, 1.0);
-    glEnd();
-
-    glPopMatrix();
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
+    quad_shader ();
+    quad_shader.SetUniformVal1i ("textured", 1);
+    quad_shader.SetUniformVal1i ("image", 0);
+    quad_shader.SetUniformVal2f ("texture_size", fbo_->getWidth(), fbo_->getHeight());
+    glActiveTexture (GL_TEXTURE0);
+    glBindVertexArray (quad_vao_);
+
+    // filtered depth and mask below, sensor depth and normals on top, depth
+    // buffer top right. everything but the normals has a single channel
+    const float rects[5][4] = {{0.0,   0.0, 0.333, 0.5},
+                               {0.333, 0.0, 0.666, 0.5},
+                               {0.0,   0.5, 0.333, 1.0},
+                               {0.333, 0.5, 0.666, 1.0},
+                               {0.666, 0.5, 1.0,   1.0}};
+    for (int i = 0; i < 5; ++i)
+    {
+      GLuint texture = (i < 4) ? fbo_->getColorAttachmentID(i) : fbo_->getDepthAttachmentID();
+      glBindTexture (fbo_->getTextureTarget(), texture);
+      quad_shader.SetUniformVal1i ("single_channel", i != NORMAL_ATTACHMENT);
+      quad_shader.SetUniformVal4f ("rect", rects[i][0], rects[i][1], rects[i][2], rects[i][3]);
+      glDrawArrays (GL_TRIANGLE_STRIP, 0, 4);
+    }
+
+    glBindVertexArray (0);
+    glUseProgram((GLuint)NULL);
   } 
 
-  fbo_->bind(1);
-  glGetTexImage (fbo_->getTextureTarget(), 0, GL_RED, GL_FLOAT, masked_depth_);
+  glEndQuery (GL_TIME_ELAPSED);
+
+  // ok, finished with all OpenGL, let's swap!
+  if (show_gui_)
+    context_->swapBuffers ();
+  // TODO: this necessary? glFlush ();
+  return true;
+}
+
+// blocking readback of filtered depth and mask into host memory
+void RealtimeURDFFilter::readback ()
+{
+  glPixelStorei (GL_PACK_ALIGNMENT, 1);
+  if (need_depth_)
+  {
+    glBindTexture (fbo_->getTextureTarget(), fbo_->getColorAttachmentID(FILTERED_ATTACHMENT));
+    if (readback_16u_)
+      glGetTexImage (fbo_->getTextureTarget(), 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, masked_depth_16u_);
+    else
+      glGetTexImage (fbo_->getTextureTarget(), 0, GL_RED, GL_FLOAT, masked_depth_);
+  }
   if (need_mask_)
   {
-    fbo_->bind(3);
+    glBindTexture (fbo_->getTextureTarget(), fbo_->getColorAttachmentID(MASK_ATTACHMENT));
     glGetTexImage (fbo_->getTextureTarget(), 0, GL_RED, GL_UNSIGNED_BYTE, mask_);
   }
+}
 
-  // ok, finished with all OpenGL, let's swap!
-  if (show_gui_)
+// blocking readback of the tiles covered by the models. all other pixels only
+// see the background, so they are filtered against it right here
+void RealtimeURDFFilter::readbackSparse (const unsigned char* depth)
+{
+  const float* depth_32f = (const float*) depth;
+  const GLushort* depth_16u = (const GLushort*) depth;
+
+  glBindTexture (GL_TEXTURE_2D, tile_texture_);
+  glGetTexImage (GL_TEXTURE_2D, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &tiles_[0]);
+  glBindTexture (GL_TEXTURE_2D, 0);
+
+  // background rule of the compare shader, for a surface just before the far plane
+  const float background = far_plane_ * 0.99;
+  const float max_diff = depth_distance_threshold_;
+  const float replace = filter_replace_value_;
+  const float uncovered = -std::numeric_limits<float>::infinity ();
+
+  // read the occupied tiles as horizontal runs, directly into the output images
+  fbo_->beginCapture (false);
+  glPixelStorei (GL_PACK_ALIGNMENT, 1);
+  glPixelStorei (GL_PACK_ROW_LENGTH, width_);
+  unsigned int occupied = 0;
+  for (int ty = 0; ty < tiles_y_; ++ty)
   {
-    glutSwapBuffers ();
-    glutPostRedisplay();
-    glutMainLoopEvent ();
+    int y0 = ty * TILE_SIZE;
+    int rows = std::min (int(TILE_SIZE), height_ - y0);
+    for (int tx = 0; tx < tiles_x_; )
+    {
+      bool covered = tiles_[ty * tiles_x_ + tx] != 0;
+      int run_end = tx + 1;
+      while (run_end < tiles_x_ && (tiles_[ty * tiles_x_ + run_end] != 0) == covered)
+        ++run_end;
+
+      int x0 = tx * TILE_SIZE;
+      int columns = std::min (run_end * TILE_SIZE, int(width_)) - x0;
+      if (covered)
+      {
+        occupied += run_end - tx;
+        if (need_depth_)
+        {
+          glReadBuffer (GL_COLOR_ATTACHMENT0 + FILTERED_ATTACHMENT);
+          if (readback_16u_)
+            glReadPixels (x0, y0, columns, rows, GL_RED_INTEGER, GL_UNSIGNED_SHORT,
+                          masked_depth_16u_ + y0 * width_ + x0);
+          else
+            glReadPixels (x0, y0, columns, rows, GL_RED, GL_FLOAT, masked_depth_ + y0 * width_ + x0);
+        }
+        if (need_mask_)
+        {
+          glReadBuffer (GL_COLOR_ATTACHMENT0 + MASK_ATTACHMENT);
+          glReadPixels (x0, y0, columns, rows, GL_RED, GL_UNSIGNED_BYTE, mask_ + y0 * width_ + x0);
+        }
+      }
+
+      // uncovered pixels, either in empty tiles or next to the models
+      if (need_depth_)
+        for (int y = y0; y < y0 + rows; ++y)
+          for (int i = y * width_ + x0; i < y * width_ + x0 + columns; ++i)
+          {
+            if (covered && (readback_16u_ ? masked_depth_16u_[i] != UNCOVERED_16U : masked_depth_[i] != uncovered))
+              continue;
+            float d = input_16u_ ? millimetersToMeters (depth_16u[i]) : depth_32f[i];
+            float filtered = (background - d > max_diff) ? d : replace;
+            if (readback_16u_)
+              masked_depth_16u_[i] = metersToMillimeters (filtered);
+            else
+              masked_depth_[i] = filtered;
+          }
+      if (need_mask_ && !covered)
+        for (int y = y0; y < y0 + rows; ++y)
+          memset (mask_ + y * width_ + x0, 0, columns);
+
+      tx = run_end;
+    }
   }
-  // TODO: this necessary? glFlush ();
+  glPixelStorei (GL_PACK_ROW_LENGTH, 0);
+  glReadBuffer (GL_COLOR_ATTACHMENT0);
+  fbo_->endCapture (false);
+
+  metrics_.setCounter ("occupied tiles", occupied);
+}
+
+// start transferring the current frame into the next pixel pack buffer
+void RealtimeURDFFilter::startReadback (ros::Time timestamp)
+{
+  int depth_bytes = width_ * height_ * (readback_16u_ ? sizeof(GLushort) : sizeof(GLfloat));
+  int size_in_bytes = depth_bytes + width_ * height_ * sizeof(GLubyte);
+
+  // (re)allocate pack buffers if the image size has changed
+  if (readback_size_ != size_in_bytes)
+  {
+    for (int i = 0; i < READBACK_RING_SIZE; ++i)
+    {
+      if (readback_fence_[i])
+        glDeleteSync (readback_fence_[i]);
+      readback_fence_[i] = 0;
+
+      if (readback_pbo_[i] == GL_INVALID_VALUE)
+        glGenBuffers (1, &readback_pbo_[i]);
+      glBindBuffer (GL_PIXEL_PACK_BUFFER, readback_pbo_[i]);
+      glBufferData (GL_PIXEL_PACK_BUFFER, size_in_bytes, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+    readback_size_ = size_in_bytes;
+  }
+
+  readback_slot_ = (readback_slot_ + 1) % READBACK_RING_SIZE;
+
+  // the previous contents of this slot were never collected
+  if (readback_fence_[readback_slot_])
+  {
+    glDeleteSync (readback_fence_[readback_slot_]);
+    readback_fence_[readback_slot_] = 0;
+  }
+
+  // with a pack buffer bound, glGetTexImage only enqueues the copy
+  glPixelStorei (GL_PACK_ALIGNMENT, 1);
+  glBindBuffer (GL_PIXEL_PACK_BUFFER, readback_pbo_[readback_slot_]);
+  if (need_depth_)
+  {
+    glBindTexture (fbo_->getTextureTarget(), fbo_->getColorAttachmentID(FILTERED_ATTACHMENT));
+    if (readback_16u_)
+      glGetTexImage (fbo_->getTextureTarget(), 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, (GLvoid*) 0);
+    else
+      glGetTexImage (fbo_->getTextureTarget(), 0, GL_RED, GL_FLOAT, (GLvoid*) 0);
+  }
+  if (need_mask_)
+  {
+    glBindTexture (fbo_->getTextureTarget(), fbo_->getColorAttachmentID(MASK_ATTACHMENT));
+    glGetTexImage (fbo_->getTextureTarget(), 0, GL_RED, GL_UNSIGNED_BYTE, (GLvoid*) (size_t) depth_bytes);
+  }
+  glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+
+  readback_fence_[readback_slot_] = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  readback_stamp_[readback_slot_] = timestamp;
+  readback_has_mask_[readback_slot_] = need_mask_;
+  readback_has_depth_[readback_slot_] = need_depth_;
+
+  // make sure the copy actually gets submitted before we wait on it next frame
+  glFlush ();
 }
 
+// copy the results of the previous frame into host memory, returns false if
+// there is nothing to collect yet
+bool RealtimeURDFFilter::finishReadback (ros::Time &timestamp, bool &has_depth, bool &has_mask)
+{
+  int slot = (readback_slot_ + READBACK_RING_SIZE - 1) % READBACK_RING_SIZE;
+  GLsync &fence = readback_fence_[slot];
+  if (!fence)
+    return false;
+
+  GLenum status;
+  do
+    status = glClientWaitSync (fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+  while (status == GL_TIMEOUT_EXPIRED);
+  glDeleteSync (fence);
+  fence = 0;
+
+  int depth_bytes = width_ * height_ * (readback_16u_ ? sizeof(GLushort) : sizeof(GLfloat));
+  int mask_bytes = width_ * height_ * sizeof(GLubyte);
+
+  glBindBuffer (GL_PIXEL_PACK_BUFFER, readback_pbo_[slot]);
+  unsigned char* data = (unsigned char*) glMapBufferRange (GL_PIXEL_PACK_BUFFER, 0, readback_size_, GL_MAP_READ_BIT);
+  if (data)
+  {
+    if (readback_has_depth_[slot] && readback_16u_)
+      memcpy (masked_depth_16u_, data, depth_bytes);
+    else if (readback_has_depth_[slot])
+      memcpy (masked_depth_, data, depth_bytes);
+    if (readback_has_mask_[slot])
+      memcpy (mask_, data + depth_bytes, mask_bytes);
+    glUnmapBuffer (GL_PIXEL_PACK_BUFFER);
+  }
+  glBindBuffer (GL_PIXEL_PACK_BUFFER, 0);
+
+  if (!data)
+  {
+    ROS_ERROR ("could not map readback buffer");
+    return false;
+  }
 
+  timestamp = readback_stamp_[slot];
+  has_depth = readback_has_depth_[slot];
+  has_mask = readback_has_mask_[slot];
+  return true;
+}
@@ -0,0 +1,331 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// offline replay benchmark for RealtimeURDFFilter::filter. loads URDF models
+// from files and depth frames from a memory mapped frame file (see
+// depth_frame_file.h), and runs the filter as fast as possible without a
+// ROS master. all links are posed from the joint origins (zero joint
+// positions), and the models are placed in a row in front of the camera.
+
+#include "realtime_urdf_filter/urdf_filter.h"
+#include "realtime_urdf_filter/depth_frame_file.h"
+#include "realtime_urdf_filter/asset_cache.h"
+
+#include <urdf/model.h>
+#include <tf/tf.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+
+using namespace realtime_urdf_filter;
+
+void usage (const char* name)
+{
+  std::cout << "usage: " << name << " [options] --urdf model.urdf [--urdf ...]" << std::endl
+            << "  --frames FILE      recorded depth frames (default: synthetic wall at 2.5m)" << std::endl
+            << "  --width W          image width (default: from frame file, or 640)" << std::endl
+            << "  --height H         image height (default: from frame file, or 480)" << std::endl
+            << "  --models N         number of instances of every URDF (default: 1)" << std::endl
+            << "  --bundle FILE      scene bundle with precompiled models (see urdf_filter_bundle)" << std::endl
+            << "  --iterations N     number of timed frames (default: 1000)" << std::endl
+            << "  --warmup N         number of untimed frames (default: 30)" << std::endl
+            << "  --mask             compute the mask output" << std::endl
+            << "  --no-depth         do not read back the filtered depth image" << std::endl
+            << "  --deferred         use deferred readback" << std::endl
+            << "  --sparse           only read back the image tiles covered by the models" << std::endl
+            << "  --static-layer     render the depth of models that do not move only once" << std::endl
+            << "  --u16              feed 16 bit millimeter frames instead of 32 bit meters" << std::endl
+            << "  --output-16u       read back the filtered depth as 16 bit millimeters" << std::endl
+            << "  --temporal-reuse E skip rendering while nothing moved by more than E" << std::endl
+            << "  --backend NAME     OpenGL context backend: glut, egl or osmesa (default: glut)," << std::endl
+            << "                     or cpu for the software rasterizer" << std::endl
+            << "  --threads N        software rasterizer threads (default: one per core)" << std::endl;
+}
+
+// read a whole text file into a string
+bool readFile (const std::string &file_name, std::string &content)
+{
+  std::ifstream ifs (file_name.c_str ());
+  if (!ifs)
+    return false;
+  std::stringstream ss;
+  ss << ifs.rdbuf ();
+  content = ss.str ();
+  return true;
+}
+
+// publish the joint origins of a model into the transformer, rooted at root_pose
+void setModelTransforms (tf::Transformer &tf, const urdf::Model &model, const std::string &prefix,
+                         const std::string &fixed_frame, const tf::Transform &root_pose)
+{
+  ros::Time stamp (1.0);
+  tf.setTransform (tf::StampedTransform (root_pose, stamp, fixed_frame,
+                                         prefix + "/" + model.getRoot ()->name));
+
+  std::map<std::string, boost::shared_ptr<urdf::Joint> >::const_iterator it;
+  for (it = model.joints_.begin (); it != model.joints_.end (); ++it)
+  {
+    const urdf::Pose &o = it->second->parent_to_joint_origin_transform;
+    tf::Transform t (tf::Quaternion (o.rotation.x, o.rotation.y, o.rotation.z, o.rotation.w),
+                     tf::Vector3 (o.position.x, o.position.y, o.position.z));
+    tf.setTransform (tf::StampedTransform (t, stamp,
+                                           prefix + "/" + it->second->parent_link_name,
+                                           prefix + "/" + it->second->child_link_name));
+  }
+}
+
+int main (int argc, char **argv)
+{
+  std::string frames_file, bundle_file, backend ("glut");
+  std::vector<std::string> urdf_files;
+  int width = 0, height = 0, num_models = 1, iterations = 1000, warmup = 30, threads = 0;
+  double temporal_reuse = -1.0;
+  bool mask = false, depth = true, deferred = false, sparse = false, static_layer = false;
+  bool input_16u = false, output_16u = false;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg (argv[i]);
+    bool has_value = (i + 1 < argc);
+    if (arg == "--frames" && has_value)           frames_file = argv[++i];
+    else if (arg == "--urdf" && has_value)        urdf_files.push_back (argv[++i]);
+    else if (arg == "--bundle" && has_value)      bundle_file = argv[++i];
+    else if (arg == "--width" && has_value)       width = atoi (argv[++i]);
+    else if (arg == "--height" && has_value)      height = atoi (argv[++i]);
+    else if (arg == "--models" && has_value)      num_models = atoi (argv[++i]);
+    else if (arg == "--iterations" && has_value)  iterations = atoi (argv[++i]);
+    else if (arg == "--warmup" && has_value)      warmup = atoi (argv[++i]);
+    else if (arg == "--backend" && has_value)     backend = argv[++i];
+    else if (arg == "--threads" && has_value)     threads = atoi (argv[++i]);
+    else if (arg == "--temporal-reuse" && has_value) temporal_reuse = atof (argv[++i]);
+    else if (arg == "--mask")                     mask = true;
+    else if (arg == "--no-depth")                 depth = false;
+    else if (arg == "--deferred")                 deferred = true;
+    else if (arg == "--sparse")                   sparse = true;
+    else if (arg == "--static-layer")             static_layer = true;
+    else if (arg == "--u16")                      input_16u = true;
+    else if (arg == "--output-16u")               output_16u = true;
+    else
+    {
+      usage (argv[0]);
+      return (arg == "--help" || arg == "-h") ? 0 : 1;
+    }
+  }
+
+  if (urdf_files.empty () || num_models < 1 || iterations < 1)
+  {
+    usage (argv[0]);
+    return 1;
+  }
+
+  // no ros::init, we only need a clock
+  ros::Time::init ();
+
+  if (!bundle_file.empty () && !AssetCache::instance ().loadBundle (bundle_file))
+  {
+    std::cerr << "could not load scene bundle " << bundle_file << std::endl;
+    return 1;
+  }
+
+  // depth frames: either memory mapped from a recording or synthetic
+  DepthFrameFile recording;
+  double fx = 525.0, fy = 525.0, cx = 319.5, cy = 239.5;
+  int source_width = 640, source_height = 480;
+  if (!frames_file.empty ())
+  {
+    if (!recording.open (frames_file))
+    {
+      std::cerr << "could not open depth frame file " << frames_file << std::endl;
+      return 1;
+    }
+    const DepthFrameFileHeader &h = recording.header ();
+    source_width = h.width;
+    source_height = h.height;
+    fx = h.fx; fy = h.fy; cx = h.cx; cy = h.cy;
+  }
+  if (width <= 0)
+    width = source_width;
+  if (height <= 0)
+    height = source_height;
+
+  // scale intrinsics to the requested resolution
+  double sx = double (width) / source_width;
+  double sy = double (height) / source_height;
+  fx *= sx; cx *= sx;
+  fy *= sy; cy *= sy;
+
+  // frames that do not match the requested resolution are resampled once
+  // (nearest neighbour) up front, everything else is used in place
+  std::vector<std::vector<float> > resampled;
+  std::vector<const float*> frames;
+  if (!frames_file.empty () && width == source_width && height == source_height)
+  {
+    for (unsigned int f = 0; f < recording.numFrames (); ++f)
+      frames.push_back (recording.frame (f));
+  }
+  else
+  {
+    unsigned int num_frames = frames_file.empty () ? 1 : recording.numFrames ();
+    resampled.resize (num_frames, std::vector<float> (width * height, 2.5f));
+    for (unsigned int f = 0; f < num_frames && !frames_file.empty (); ++f)
+    {
+      const float* src = recording.frame (f);
+      for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+          resampled[f][y * width + x] = src[(y * source_height / height) * source_width + (x * source_width / width)];
+    }
+    for (unsigned int f = 0; f < num_frames; ++f)
+      frames.push_back (&resampled[f][0]);
+  }
+  if (frames.empty ())
+  {
+    std::cerr << "depth frame file " << frames_file << " contains no frames" << std::endl;
+    return 1;
+  }
+
+  // 16 bit millimeters, like a Kinect / OpenNI depth image
+  std::vector<std::vector<unsigned short> > frames_16u;
+  if (input_16u)
+  {
+    frames_16u.resize (frames.size (), std::vector<unsigned short> (width * height));
+    for (unsigned int f = 0; f < frames.size (); ++f)
+      for (int i = 0; i < width * height; ++i)
+        frames_16u[f][i] = (frames[f][i] > 0.0f) ? (unsigned short) std::min (frames[f][i] * 1000.0f + 0.5f, 65534.0f) : 0;
+  }
+
+  // TF data for all model instances
+  tf::Transformer tf (false);
+  RealtimeURDFFilter filter (tf, argc, argv);
+  filter.width_ = width;
+  filter.height_ = height;
+  filter.context_backend_ = backend;
+  filter.cpu_render_ = (backend == "cpu");
+  filter.cpu_render_threads_ = std::max (0, threads);
+  filter.deferred_readback_ = deferred;
+  filter.sparse_readback_ = sparse && !deferred;
+  filter.static_layer_ = static_layer;
+  filter.output_16u_ = output_16u;
+  filter.temporal_reuse_epsilon_ = temporal_reuse;
+  filter.force_mask_output_ = mask;
+  filter.force_depth_output_ = depth;
+
+  // camera at the origin of the fixed frame, looking along z
+  tf.setTransform (tf::StampedTransform (tf::Transform::getIdentity (), ros::Time (1.0),
+                                         filter.fixed_frame_, filter.cam_frame_));
+
+  int instance = 0;
+  int num_instances = num_models * urdf_files.size ();
+  for (unsigned int u = 0; u < urdf_files.size (); ++u)
+  {
+    std::string content;
+    urdf::Model model;
+    if (!readFile (urdf_files[u], content) || !model.initString (content))
+    {
+      std::cerr << "could not load URDF " << urdf_files[u] << std::endl;
+      return 1;
+    }
+
+    for (int m = 0; m < num_models; ++m, ++instance)
+    {
+      std::ostringstream prefix;
+      prefix << "/bench_" << instance;
+
+      // place the instances in a row, 2 meters in front of the camera
+      double x = (instance - 0.5 * (num_instances - 1)) * 0.8;
+      tf::Transform root_pose (tf::Quaternion::getIdentity (), tf::Vector3 (x, 0.0, 2.0));
+      setModelTransforms (tf, model, prefix.str (), filter.fixed_frame_, root_pose);
+      filter.addModel (content, prefix.str ());
+    }
+  }
+
+  filter.initGL ();
+  if (!filter.cpu_render_ && !filter.fbo_initialized_)
+  {
+    std::cerr << "could not initialize OpenGL with backend " << backend << std::endl;
+    return 1;
+  }
+
+  double glTf[16];
+  for (unsigned int i = 0; i < 16; ++i)
+    glTf[i] = 0.0;
+  glTf[0]= -2.0 * fx / width;
+  glTf[5]= 2.0 * fy / height;
+  glTf[8]= 2.0 * (0.5 - cx / width);
+  glTf[9]= 2.0 * (cy / height - 0.5);
+  glTf[10]= - (filter.far_plane_ + filter.near_plane_) / (filter.far_plane_ - filter.near_plane_);
+  glTf[14]= -2.0 * filter.far_plane_ * filter.near_plane_ / (filter.far_plane_ - filter.near_plane_);
+  glTf[11]= -1;
+
+  std::cout << "benchmarking " << num_instances << " model(s) at " << width << "x" << height
+            << ", " << frames.size () << " distinct frame(s), backend " << backend
+            << (deferred ? ", deferred readback" : "")
+            << (filter.sparse_readback_ ? ", sparse readback" : "")
+            << (input_16u ? ", 16 bit input" : "") << (output_16u ? ", 16 bit output" : "")
+            << (mask ? ", mask" : "") << (depth ? ", depth" : "") << std::endl;
+
+  ros::WallTime start;
+  for (int i = 0; i < warmup + iterations; ++i)
+  {
+    if (i == warmup)
+    {
+      // the counters from loading the models are kept
+      if (filter.context_)
+        glFinish ();
+      filter.metrics_.clearSamples (iterations);
+      start = ros::WallTime::now ();
+    }
+    ros::Time stamp (1.0 + i * 0.001);
+    if (input_16u)
+      filter.filter (&frames_16u[i % frames.size ()][0], glTf, width, height, stamp);
+    else
+      filter.filter ((unsigned char*) frames[i % frames.size ()], glTf, width, height, stamp);
+  }
+  if (filter.context_)
+    glFinish ();
+  double elapsed = (ros::WallTime::now () - start).toSec ();
+
+  std::cout << std::endl;
+  filter.metrics_.print (std::cout);
+  std::cout << std::endl << "throughput: " << iterations / elapsed << " frames/s ("
+            << iterations << " frames in " << elapsed << " s)" << std::endl;
+
+  // the node turns these on by default, the benchmark only when asked to
+  std::cout << "progressive loading " << (filter.progressive_loading_ ? "on" : "off")
+            << ", static layer " << (filter.static_layer_ ? "on" : "off") << ", temporal reuse ";
+  if (filter.temporal_reuse_epsilon_ >= 0.0)
+    std::cout << "epsilon " << filter.temporal_reuse_epsilon_ << std::endl;
+  else
+    std::cout << "off" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,314 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// compiles URDF models and their meshes into a scene bundle (see
+// scene_bundle.h). RealtimeURDFFilter loads a bundle given in the
+// "scene_bundle" parameter and then skips URDF parsing and mesh import for
+// every description in it. descriptions are matched by content, so bundle
+// exactly what is on the parameter server: either the same file, or the
+// parameter itself with --param.
+
+#include "realtime_urdf_filter/urdf_renderer.h"
+#include "realtime_urdf_filter/asset_cache.h"
+#include "realtime_urdf_filter/scene_bundle.h"
+
+#include <ros/ros.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace realtime_urdf_filter;
+
+void usage (const char* name)
+{
+  std::cout << "usage: " << name << " -o FILE [model.urdf ...] [--param NAME ...]" << std::endl
+            << "  -o FILE            bundle to write" << std::endl
+            << "  --param NAME       read a description from the parameter server (needs a master)" << std::endl;
+}
+
+// read a whole text file into a string
+bool readFile (const std::string &file_name, std::string &content)
+{
+  std::ifstream ifs (file_name.c_str ());
+  if (!ifs)
+    return false;
+  std::stringstream ss;
+  ss << ifs.rdbuf ();
+  content = ss.str ();
+  return true;
+}
+
+// bundle transforms are x y z qx qy qz qw
+void writeTransform (const urdf::Pose &pose, float* t)
+{
+  t[0] = pose.position.x;
+  t[1] = pose.position.y;
+  t[2] = pose.position.z;
+  t[3] = pose.rotation.x;
+  t[4] = pose.rotation.y;
+  t[5] = pose.rotation.z;
+  t[6] = pose.rotation.w;
+}
+
+void writeTransform (const tf::Transform &transform, float* t)
+{
+  tf::Quaternion q = transform.getRotation ();
+  t[0] = transform.getOrigin ().x ();
+  t[1] = transform.getOrigin ().y ();
+  t[2] = transform.getOrigin ().z ();
+  t[3] = q.x ();
+  t[4] = q.y ();
+  t[5] = q.z ();
+  t[6] = q.w ();
+}
+
+// collects the sections of the bundle
+class BundleWriter
+{
+  public:
+    // adds a model and all its links, creates the geometry through the
+    // AssetCache just like URDFRenderer does
+    bool addModel (const std::string &description)
+    {
+      boost::shared_ptr<const urdf::Model> model = AssetCache::instance ().getModel (description);
+      if (!model)
+        return false;
+
+      std::vector<boost::shared_ptr<urdf::Link> > links;
+      model->getLinks (links);
+      std::map<std::string, int> link_index;
+      for (unsigned int i = 0; i < links.size (); ++i)
+        link_index[links[i]->name] = i;
+
+      BundleModel bm;
+      bm.description_hash = hashDescription (description);
+      bm.description_size = description.size ();
+      bm.name = addString (model->getName ());
+      bm.first_link = links_.size ();
+      bm.num_links = links.size ();
+      models_.push_back (bm);
+
+      for (unsigned int i = 0; i < links.size (); ++i)
+      {
+        const urdf::Link &link = *links[i];
+        BundleLink bl;
+        memset (&bl, 0, sizeof(bl));
+        bl.name = addString (link.name);
+        bl.parent = -1;
+        bl.joint_name = addString ("");
+        bl.joint_origin[6] = 1.0f;
+        bl.visual_origin[6] = 1.0f;
+        if (link.parent_joint)
+        {
+          const urdf::Joint &joint = *link.parent_joint;
+          std::map<std::string, int>::const_iterator parent = link_index.find (joint.parent_link_name);
+          if (parent != link_index.end ())
+            bl.parent = parent->second;
+          bl.joint_name = addString (joint.name);
+          bl.joint_type = joint.type;
+          writeTransform (joint.parent_to_joint_origin_transform, bl.joint_origin);
+          bl.joint_axis[0] = joint.axis.x;
+          bl.joint_axis[1] = joint.axis.y;
+          bl.joint_axis[2] = joint.axis.z;
+        }
+
+        bl.geometry = -1;
+        boost::shared_ptr<Renderable> r = URDFRenderer::createRenderable (link);
+        if (r)
+        {
+          renderables_.push_back (r);
+          bl.geometry = geometryIndex (r->geometry);
+          writeTransform (r->link_offset, bl.visual_origin);
+          bl.scale[0] = r->scale.x ();
+          bl.scale[1] = r->scale.y ();
+          bl.scale[2] = r->scale.z ();
+          bl.color[0] = r->color.r;
+          bl.color[1] = r->color.g;
+          bl.color[2] = r->color.b;
+          bl.color[3] = r->color.a;
+        }
+        links_.push_back (bl);
+      }
+      return true;
+    }
+
+    bool write (const std::string &file_name)
+    {
+      // geometry keys, as the AssetCache knows them
+      std::map<std::string, boost::shared_ptr<Geometry> > cached;
+      AssetCache::instance ().getGeometries (cached);
+      std::map<Geometry*, std::string> keys;
+      for (std::map<std::string, boost::shared_ptr<Geometry> >::const_iterator it = cached.begin (); it != cached.end (); ++it)
+        keys[it->second.get ()] = it->first;
+
+      std::vector<BundleGeometry> geometries;
+      std::vector<Geometry::Vertex> vertices;
+      std::vector<uint32_t> indices;
+      for (unsigned int g = 0; g < geometries_.size (); ++g)
+      {
+        const Geometry &geometry = *geometries_[g];
+        BundleGeometry bg;
+        bg.key = addString (keys[geometries_[g].get ()]);
+        bg.shape = geometry.shape;
+        bg.first_vertex = vertices.size ();
+        bg.num_vertices = geometry.vertices.size ();
+        bg.first_index = indices.size ();
+        bg.num_indices = geometry.indices.size ();
+        geometries.push_back (bg);
+        vertices.insert (vertices.end (), geometry.vertices.begin (), geometry.vertices.end ());
+        indices.insert (indices.end (), geometry.indices.begin (), geometry.indices.end ());
+      }
+
+      SceneBundleHeader header;
+      memset (&header, 0, sizeof(header));
+      memcpy (header.magic, "RUFSCENE", 8);
+      header.version = 1;
+      header.num_models = models_.size ();
+      header.num_links = links_.size ();
+      header.num_geometries = geometries.size ();
+      header.num_vertices = vertices.size ();
+      header.num_indices = indices.size ();
+      header.strings_size = strings_.size ();
+
+      std::ofstream ofs (file_name.c_str (), std::ios::binary);
+      ofs.write ((const char*) &header, sizeof(header));
+      writeSection (ofs, models_);
+      writeSection (ofs, links_);
+      writeSection (ofs, geometries);
+      writeSection (ofs, vertices);
+      writeSection (ofs, indices);
+      writeSection (ofs, strings_);
+      if (!ofs)
+        return false;
+
+      std::cout << "wrote " << header.num_models << " models, " << header.num_links << " links, "
+                << header.num_geometries << " geometries (" << header.num_vertices << " vertices, "
+                << header.num_indices << " indices) to " << file_name << std::endl;
+      return true;
+    }
+
+  private:
+    template <typename T>
+    void writeSection (std::ofstream &ofs, const std::vector<T> &v)
+    {
+      if (!v.empty ())
+        ofs.write ((const char*) &v[0], v.size () * sizeof(T));
+    }
+
+    uint32_t addString (const std::string &s)
+    {
+      std::map<std::string, uint32_t>::const_iterator it = string_offsets_.find (s);
+      if (it != string_offsets_.end ())
+        return it->second;
+      uint32_t offset = strings_.size ();
+      strings_.insert (strings_.end (), s.begin (), s.end ());
+      strings_.push_back ('\0');
+      string_offsets_[s] = offset;
+      return offset;
+    }
+
+    int32_t geometryIndex (const boost::shared_ptr<Geometry> &geometry)
+    {
+      for (unsigned int g = 0; g < geometries_.size (); ++g)
+        if (geometries_[g] == geometry)
+          return g;
+      geometries_.push_back (geometry);
+      return geometries_.size () - 1;
+    }
+
+    std::vector<BundleModel> models_;
+    std::vector<BundleLink> links_;
+    std::vector<boost::shared_ptr<Geometry> > geometries_;
+    std::vector<char> strings_;
+    std::map<std::string, uint32_t> string_offsets_;
+
+    // keep the geometry in the cache until it is written
+    std::vector<boost::shared_ptr<Renderable> > renderables_;
+};
+
+int main (int argc, char **argv)
+{
+  std::string output;
+  std::vector<std::string> urdf_files, params;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string arg (argv[i]);
+    bool has_value = (i + 1 < argc);
+    if (arg == "-o" && has_value)                 output = argv[++i];
+    else if (arg == "--param" && has_value)       params.push_back (argv[++i]);
+    else if (!arg.empty () && arg[0] != '-')      urdf_files.push_back (arg);
+    else
+    {
+      usage (argv[0]);
+      return (arg == "--help" || arg == "-h") ? 0 : 1;
+    }
+  }
+
+  if (output.empty () || (urdf_files.empty () && params.empty ()))
+  {
+    usage (argv[0]);
+    return 1;
+  }
+
+  BundleWriter writer;
+  for (unsigned int u = 0; u < urdf_files.size (); ++u)
+  {
+    std::string content;
+    if (!readFile (urdf_files[u], content) || !writer.addModel (content))
+    {
+      std::cerr << "could not load URDF " << urdf_files[u] << std::endl;
+      return 1;
+    }
+  }
+
+  if (!params.empty ())
+  {
+    ros::init (argc, argv, "urdf_filter_bundle", ros::init_options::AnonymousName);
+    ros::NodeHandle nh;
+    for (unsigned int p = 0; p < params.size (); ++p)
+    {
+      std::string content;
+      if (!nh.getParam (params[p], content) || !writer.addModel (content))
+      {
+        std::cerr << "could not load URDF from parameter " << params[p] << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  if (!writer.write (output))
+  {
+    std::cerr << "could not write " << output << std::endl;
+    return 1;
+  }
+  return 0;
+}
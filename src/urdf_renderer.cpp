@@ -30,7 +30,6 @@
 
 
 #include <GL/glew.h>
-#include <GL3/gl3.h>
 #include <GL/glu.h>
 #include <GL/glx.h>
 #undef Success  // <---- Screw Xlib for this
@@ -38,6 +37,10 @@
 #include <ros/node_handle.h>
 
 #include <realtime_urdf_filter/urdf_renderer.h>
+#include <realtime_urdf_filter/asset_cache.h>
+#include <realtime_urdf_filter/worker_pool.h>
+#include <boost/bind.hpp>
+#include <cmath>
 
 namespace realtime_urdf_filter
 {
@@ -45,31 +48,46 @@ namespace realtime_urdf_filter
                               std::string tf_prefix,
                               std::string cam_frame,
                               std::string fixed_frame,
-                              tf::TransformListener &tf)
+                              tf::Transformer &tf,
+                              WorkerPool *pool,
+                              bool defer_meshes)
     : model_description_(model_description)
     , tf_prefix_(tf_prefix)
     , camera_frame_ (cam_frame)
     , fixed_frame_(fixed_frame)
     , tf_(tf)
+    , num_swapped_ (0)
+    , cancelled_ (false)
   {
-    initURDFModel ();
+    initURDFModel (pool, defer_meshes);
     tf_.setExtrapolationLimit (ros::Duration (5.0));
   }
 
   ////////////////////////////////////////////////////////////////////////////////
-  /** \brief Loads URDF model from the parameter server and parses it. call loadURDFModel */
+  /** \brief Parses the URDF model (or takes it from the AssetCache). call loadURDFModel */
   void
-    URDFRenderer::initURDFModel ()
+    URDFRenderer::initURDFModel (WorkerPool *pool, bool defer_meshes)
   {
-    urdf::Model model;
-    if (!model.initString(model_description_))
+    // precompiled in a scene bundle: no parsing, no mesh import
+    compiled_model_ = AssetCache::instance ().getCompiledModel (model_description_);
+    if (compiled_model_)
+    {
+      kinematics_.init (*compiled_model_);
+      loadCompiledModel (*compiled_model_);
+      ROS_INFO ("URDF loaded from scene bundle");
+      return;
+    }
+
+    model_ = AssetCache::instance ().getModel (model_description_);
+    if (!model_)
     {
       ROS_ERROR ("URDF failed Model parse");
       return;
     }
 
     ROS_INFO ("URDF parsed OK");
-    loadURDFModel (model);
+    kinematics_.init (*model_);
+    loadURDFModel (*model_, pool, defer_meshes);
     ROS_INFO ("URDF loaded OK");
   }
 
@@ -77,65 +95,281 @@ namespace realtime_urdf_filter
   /// /////////////////////////////////////////////////////////////////////////////
   /// @brief load URDF model description from string and create search operations data structures
   void URDFRenderer::loadURDFModel
-    (urdf::Model &model)
+    (const urdf::Model &model, WorkerPool *pool, bool defer_meshes)
   {
     typedef std::vector<boost::shared_ptr<urdf::Link> > V_Link;
-    V_Link links;
-    model.getLinks(links);
+    V_Link all_links, links;
+    model.getLinks(all_links);
+
+    // links with meshes that still have to be imported start out as a proxy
+    for (unsigned int i = 0; i < all_links.size (); ++i)
+    {
+      if (!defer_meshes || !hasUncachedMesh (*all_links[i]))
+      {
+        links.push_back (all_links[i]);
+        continue;
+      }
+
+      PendingLink pending;
+      pending.link = all_links[i];
+      pending.slot = -1;
+      boost::shared_ptr<Renderable> proxy = createProxy (*all_links[i]);
+      if (proxy)
+      {
+        proxy->setLinkName (tf_prefix_+ "/" + all_links[i]->name);
+        pending.slot = renderables_.size ();
+        renderables_.push_back (proxy);
+      }
+      else
+        ROS_WARN ("link %s/%s is not filtered until its mesh is loaded: it has no collision primitive "
+                  "or cached collision mesh to stand in for it", tf_prefix_.c_str (), all_links[i]->name.c_str ());
+      pending_.push_back (pending);
+    }
 
-    V_Link::iterator it = links.begin();
-    V_Link::iterator end = links.end();
+    // mesh imports are independent of each other, so they run in parallel
+    std::vector<boost::shared_ptr<Renderable> > renderables (links.size ());
+    boost::function<void (unsigned int)> job = boost::bind (&URDFRenderer::processLinkJob, &links, &renderables, _1);
+    if (pool)
+      pool->run (job, links.size ());
+    else
+      for (unsigned int i = 0; i < links.size (); ++i)
+        job (i);
 
-    for (; it != end; ++it)
-      process_link (*it);
+    for (unsigned int i = 0; i < links.size (); ++i)
+    {
+      if (!renderables[i])
+        continue;
+      renderables[i]->setLinkName (tf_prefix_+ "/" + links[i]->name);
+      renderables_.push_back (renderables[i]);
+    }
   }
 
   ////////////////////////////////////////////////////////////////////////////////
-  /** \brief Processes a single URDF link, creates renderable for it */
-  void URDFRenderer::process_link (boost::shared_ptr<urdf::Link> link)
+  /** \brief creates the renderable of link i, called on the loader threads */
+  void URDFRenderer::processLinkJob (const std::vector<boost::shared_ptr<urdf::Link> > *links,
+                                     std::vector<boost::shared_ptr<Renderable> > *renderables,
+                                     unsigned int i)
   {
-    if (link->visual.get() == NULL || link->visual->geometry.get() == NULL)
-      return;
+    (*renderables)[i] = createRenderable (*(*links)[i]);
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief creates the renderables of a model from a scene bundle */
+  void URDFRenderer::loadCompiledModel (const CompiledModel &model)
+  {
+    for (unsigned int i = 0; i < model.links.size (); ++i)
+    {
+      const CompiledLink &link = model.links[i];
+      if (!link.geometry)
+        continue;
+
+      // the unit geometry is shared, so the base class is all we need
+      boost::shared_ptr<Renderable> r (new Renderable);
+      r->geometry = link.geometry;
+      r->scale = link.scale;
+      r->setLinkName (tf_prefix_+ "/" + link.name);
+      r->link_offset = link.visual_origin;
+      r->color = link.color;
+      renderables_.push_back (r);
+    }
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief creates the renderable for the visual of a link, with its offset
+   * and color but without a name. returns NULL if the link has no visual */
+  boost::shared_ptr<Renderable> URDFRenderer::createRenderable (const urdf::Link &link)
+  {
+    boost::shared_ptr<Renderable> r;
+    if (link.visual.get() == NULL || link.visual->geometry.get() == NULL)
+      return r;
 
+    r = createRenderable (*link.visual->geometry, link.visual->origin);
+    if (r && link.visual->material)
+      r->color  = link.visual->material->color;
+    return r;
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief creates the renderable for a URDF geometry, with its offset */
+  boost::shared_ptr<Renderable> URDFRenderer::createRenderable (const urdf::Geometry &geometry, const urdf::Pose &pose)
+  {
     boost::shared_ptr<Renderable> r;
-    if (link->visual->geometry->type == urdf::Geometry::BOX)
+    if (geometry.type == urdf::Geometry::BOX)
     {
-      boost::shared_ptr<urdf::Box> box = boost::dynamic_pointer_cast<urdf::Box> (link->visual->geometry);
-      r.reset (new RenderableBox (box->dim.x, box->dim.y, box->dim.z));
+      const urdf::Box &box = static_cast<const urdf::Box&> (geometry);
+      r.reset (new RenderableBox (box.dim.x, box.dim.y, box.dim.z));
     }
-    else if (link->visual->geometry->type == urdf::Geometry::CYLINDER)
+    else if (geometry.type == urdf::Geometry::CYLINDER)
     {
-      boost::shared_ptr<urdf::Cylinder> cylinder = boost::dynamic_pointer_cast<urdf::Cylinder> (link->visual->geometry);
-      r.reset (new RenderableCylinder (cylinder->radius, cylinder->length));
+      const urdf::Cylinder &cylinder = static_cast<const urdf::Cylinder&> (geometry);
+      r.reset (new RenderableCylinder (cylinder.radius, cylinder.length));
     }
-    else if (link->visual->geometry->type == urdf::Geometry::SPHERE)
+    else if (geometry.type == urdf::Geometry::SPHERE)
     {
-      boost::shared_ptr<urdf::Sphere> sphere = boost::dynamic_pointer_cast<urdf::Sphere> (link->visual->geometry);
-      r.reset (new RenderableSphere (sphere->radius));
+      const urdf::Sphere &sphere = static_cast<const urdf::Sphere&> (geometry);
+      r.reset (new RenderableSphere (sphere.radius));
     }
-    else if (link->visual->geometry->type == urdf::Geometry::MESH)
+    else if (geometry.type == urdf::Geometry::MESH)
     {
-      boost::shared_ptr<urdf::Mesh> mesh = boost::dynamic_pointer_cast<urdf::Mesh> (link->visual->geometry);
-      std::string meshname (mesh->filename);
-      RenderableMesh* rm = new RenderableMesh (meshname);
-      rm->setScale (mesh->scale.x, mesh->scale.y, mesh->scale.z);
+      const urdf::Mesh &mesh = static_cast<const urdf::Mesh&> (geometry);
+      RenderableMesh* rm = new RenderableMesh (mesh.filename);
+      rm->setScale (mesh.scale.x, mesh.scale.y, mesh.scale.z);
       r.reset (rm);
     }
-    r->setLinkName (tf_prefix_+ "/" + link->name);
-    urdf::Vector3 origin = link->visual->origin.position;
-    urdf::Rotation rotation = link->visual->origin.rotation;
+    else
+      return r;
+    urdf::Vector3 origin = pose.position;
+    urdf::Rotation rotation = pose.rotation;
     r->link_offset = tf::Transform (
         tf::Quaternion (rotation.x, rotation.y, rotation.z, rotation.w).normalize (),
         tf::Vector3 (origin.x, origin.y, origin.z));
-    if (link->visual && 
-        (link->visual->material))
-      r->color  = link->visual->material->color;
-    renderables_.push_back (r); 
+    return r;
   }
 
   ////////////////////////////////////////////////////////////////////////////////
-  /** \brief loops over all renderables and updates its transforms from TF */
+  /** \brief true if the visual of link is a mesh that has not been imported */
+  bool URDFRenderer::hasUncachedMesh (const urdf::Link &link)
+  {
+    if (!link.visual || !link.visual->geometry || link.visual->geometry->type != urdf::Geometry::MESH)
+      return false;
+    const urdf::Mesh &mesh = static_cast<const urdf::Mesh&> (*link.visual->geometry);
+    return !AssetCache::instance ().hasGeometry ("mesh " + mesh.filename);
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief the collision primitive of link, which usually encloses the visual
+   * mesh. a collision mesh that is already cached (e.g. from a scene bundle)
+   * is replaced by its bounding box. NULL if the collision geometry is
+   * missing, or a mesh that has not been imported */
+  boost::shared_ptr<Renderable> URDFRenderer::createProxy (const urdf::Link &link)
+  {
+    boost::shared_ptr<Renderable> r;
+    if (!link.collision || !link.collision->geometry)
+      return r;
+    if (link.collision->geometry->type != urdf::Geometry::MESH)
+      return createRenderable (*link.collision->geometry, link.collision->origin);
+
+    const urdf::Mesh &mesh = static_cast<const urdf::Mesh&> (*link.collision->geometry);
+    boost::shared_ptr<Geometry> geometry = AssetCache::instance ().findGeometry ("mesh " + mesh.filename);
+    if (!geometry || geometry->vertices.empty ())
+      return r;
+
+    // the box is centered on the mesh bounds, in the scaled mesh frame
+    tf::Vector3 min_pt, max_pt;
+    geometry->getBoundingBox (min_pt, max_pt);
+    tf::Vector3 scale (mesh.scale.x, mesh.scale.y, mesh.scale.z);
+    tf::Vector3 size = (max_pt - min_pt) * scale;
+    r.reset (new RenderableBox (std::fabs (size.x ()), std::fabs (size.y ()), std::fabs (size.z ())));
+
+    urdf::Vector3 origin = link.collision->origin.position;
+    urdf::Rotation rotation = link.collision->origin.rotation;
+    r->link_offset = tf::Transform (
+        tf::Quaternion (rotation.x, rotation.y, rotation.z, rotation.w).normalize (),
+        tf::Vector3 (origin.x, origin.y, origin.z));
+    r->link_offset *= tf::Transform (tf::Quaternion::getIdentity (), (min_pt + max_pt) * 0.5 * scale);
+    return r;
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief imports the meshes of the deferred links on the pool */
+  void URDFRenderer::loadPendingLinks (WorkerPool *pool)
+  {
+    pool->run (boost::bind (&URDFRenderer::loadPendingJob, this, _1), pending_.size ());
+  }
+
+  void URDFRenderer::loadPendingJob (unsigned int i)
+  {
+    {
+      boost::mutex::scoped_lock lock (pending_mutex_);
+      if (cancelled_)
+        return;
+    }
+
+    boost::shared_ptr<Renderable> r = createRenderable (*pending_[i].link);
+
+    boost::mutex::scoped_lock lock (pending_mutex_);
+    pending_[i].loaded = r;
+    ready_.push_back (i);
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief replaces the proxies of all links that finished loading */
+  bool URDFRenderer::swapLoadedLinks ()
+  {
+    if (num_swapped_ == pending_.size ())
+      return false;
+
+    boost::mutex::scoped_lock lock (pending_mutex_);
+    bool changed = false;
+    for (unsigned int r = 0; r < ready_.size (); ++r)
+    {
+      PendingLink &pending = pending_[ready_[r]];
+      ++num_swapped_;
+      if (!pending.loaded)
+        continue;
+
+      pending.loaded->setLinkName (tf_prefix_+ "/" + pending.link->name);
+      if (pending.slot >= 0)
+        renderables_[pending.slot] = pending.loaded;
+      else
+        renderables_.push_back (pending.loaded);
+      pending.loaded.reset ();
+      changed = true;
+    }
+    ready_.clear ();
+    return changed;
+  }
+
+  void URDFRenderer::cancelPendingLinks ()
+  {
+    boost::mutex::scoped_lock lock (pending_mutex_);
+    cancelled_ = true;
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief updates the transforms of all renderables, from the forward
+   * kinematics if there are joint positions, otherwise from TF */
   void URDFRenderer::update_link_transforms ()
+  {
+    if (!kinematics_.hasJointState ())
+    {
+      updateLinkTransformsFromTF ();
+      return;
+    }
+
+    // one lookup for the whole model, without it the links keep their last
+    // poses
+    tf::StampedTransform t;
+    try
+    {
+      tf_.lookupTransform (fixed_frame_, tf_prefix_ + "/" + kinematics_.rootLink (), ros::Time (), t);
+    }
+    catch (tf::TransformException ex)
+    {
+      ROS_ERROR("%s",ex.what());
+      return;
+    }
+    kinematics_.computeLinkPoses (tf::Transform (t.getRotation (), t.getOrigin ()), link_poses_);
+
+    if (renderable_links_.size () != renderables_.size ())
+    {
+      renderable_links_.resize (renderables_.size ());
+      for (unsigned int i = 0; i < renderables_.size (); ++i)
+        renderable_links_[i] = kinematics_.linkIndex (renderables_[i]->name.substr (tf_prefix_.size () + 1));
+    }
+    for (unsigned int i = 0; i < renderables_.size (); ++i)
+      if (renderable_links_[i] >= 0)
+        renderables_[i]->link_to_fixed = link_poses_[renderable_links_[i]];
+  }
+
+  void URDFRenderer::setJointState (const sensor_msgs::JointState::ConstPtr &state)
+  {
+    kinematics_.setJointState (*state);
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief loops over all renderables and updates its transforms from TF */
+  void URDFRenderer::updateLinkTransformsFromTF ()
   {
     tf::StampedTransform t;
 
@@ -154,17 +388,6 @@ namespace realtime_urdf_filter
     }
   }
 
-  ////////////////////////////////////////////////////////////////////////////////
-  /** \brief loops over all renderables and renders them to canvas */
-  void URDFRenderer::render ()
-  {
-    update_link_transforms ();
-      
-    std::vector<boost::shared_ptr<Renderable> >::const_iterator it = renderables_.begin ();
-    for (; it != renderables_.end (); it++)
-      (*it)->render ();
-  }
-
 }
 
 // REGEX BASED LINK / SEARCH OPERATIONS / TARGET FRAMES SETUP
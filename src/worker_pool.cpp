@@ -0,0 +1,104 @@
+/* 
+ * Copyright (c) 2011, Nico Blodow <blodow@cs.tum.edu>
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Intelligent Autonomous Systems Group/
+ *       Technische Universitaet Muenchen nor the names of its contributors 
+ *       may be used to endorse or promote products derived from this software 
+ *       without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <realtime_urdf_filter/worker_pool.h>
+#include <algorithm>
+
+namespace realtime_urdf_filter
+{
+  WorkerPool::WorkerPool (unsigned int num_threads)
+    : num_threads_ (num_threads)
+    , job_ (NULL)
+    , next_ (0)
+    , count_ (0)
+    , pending_ (0)
+    , stop_ (false)
+  {
+    if (num_threads_ == 0)
+      num_threads_ = std::max (1u, boost::thread::hardware_concurrency ());
+
+    for (unsigned int i = 0; i < num_threads_; ++i)
+      threads_.create_thread (boost::bind (&WorkerPool::workerLoop, this));
+  }
+
+  WorkerPool::~WorkerPool ()
+  {
+    {
+      boost::mutex::scoped_lock lock (mutex_);
+      stop_ = true;
+    }
+    work_cond_.notify_all ();
+    threads_.join_all ();
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief calls job (i) for every i in [0, count) and waits for completion */
+  void WorkerPool::run (const boost::function<void (unsigned int)> &job, unsigned int count)
+  {
+    if (count == 0)
+      return;
+
+    boost::mutex::scoped_lock lock (mutex_);
+    job_ = &job;
+    next_ = 0;
+    count_ = count;
+    pending_ = count;
+    work_cond_.notify_all ();
+
+    while (pending_ > 0)
+      done_cond_.wait (lock);
+    job_ = NULL;
+  }
+
+  ////////////////////////////////////////////////////////////////////////////////
+  /** \brief takes job indices until there are none left */
+  void WorkerPool::workerLoop ()
+  {
+    boost::mutex::scoped_lock lock (mutex_);
+    while (true)
+    {
+      while (!stop_ && next_ >= count_)
+        work_cond_.wait (lock);
+      if (stop_)
+        return;
+
+      unsigned int index = next_++;
+      const boost::function<void (unsigned int)> &job = *job_;
+
+      lock.unlock ();
+      job (index);
+      lock.lock ();
+
+      if (--pending_ == 0)
+        done_cond_.notify_all ();
+    }
+  }
+
+} // end namespace